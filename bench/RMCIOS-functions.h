@@ -0,0 +1,135 @@
+/* 
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Minimal stand-in for RMCIOS-functions.h used by the benchmarks.
+// Declares only the subset of the interface used by linux_channels.c.
+// Implemented in rmcios_stub.c. 
+
+#ifndef RMCIOS_FUNCTIONS_H
+#define RMCIOS_FUNCTIONS_H
+
+#include <string.h>
+
+enum function_rmcios
+{
+    help_rmcios,
+    setup_rmcios,
+    write_rmcios,
+    read_rmcios,
+    create_rmcios,
+    link_rmcios
+} ;
+
+enum type_rmcios
+{
+    int_rmcios,
+    float_rmcios,
+    buffer_rmcios,
+    channel_rmcios,
+    combo_rmcios
+} ;
+
+struct buffer_rmcios
+{
+    char *data ;
+    int length ;
+    int size ;
+    int required_size ;
+    int trailing_size ;
+} ;
+
+union param_rmcios
+{
+    int i ;
+    int *iv ;
+    float *fv ;
+    struct buffer_rmcios *bv ;
+    void *p ;
+} ;
+
+struct context_rmcios ;
+
+typedef void (*class_rmcios) (void *data, 
+                              const struct context_rmcios *context, 
+                              int id, enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              union param_rmcios returnv,
+                              int num_params, union param_rmcios param) ;
+
+struct context_rmcios
+{
+    void (*run_channel) (const struct context_rmcios *context, int id,
+                         enum function_rmcios function,
+                         enum type_rmcios paramtype,
+                         union param_rmcios returnv,
+                         int num_params, union param_rmcios param) ;
+} ;
+
+void return_string(const struct context_rmcios *context, 
+                   enum type_rmcios paramtype, union param_rmcios returnv,
+                   const char *string) ;
+void return_int(const struct context_rmcios *context, 
+                enum type_rmcios paramtype, union param_rmcios returnv,
+                int value) ;
+void return_float(const struct context_rmcios *context, 
+                  enum type_rmcios paramtype, union param_rmcios returnv,
+                  float value) ;
+void return_buffer(const struct context_rmcios *context, 
+                   enum type_rmcios paramtype, union param_rmcios returnv,
+                   const char *buffer, int length) ;
+
+int param_to_int(const struct context_rmcios *context, 
+                 enum type_rmcios paramtype, union param_rmcios param, 
+                 int index) ;
+float param_to_float(const struct context_rmcios *context, 
+                     enum type_rmcios paramtype, union param_rmcios param, 
+                     int index) ;
+const char *param_to_string(const struct context_rmcios *context, 
+                            enum type_rmcios paramtype, 
+                            union param_rmcios param, int index, 
+                            int maxlen, char *buffer) ;
+int param_string_length(const struct context_rmcios *context, 
+                        enum type_rmcios paramtype, 
+                        union param_rmcios param, int index) ;
+int param_string_alloc_size(const struct context_rmcios *context, 
+                            enum type_rmcios paramtype, 
+                            union param_rmcios param, int index) ;
+
+int create_channel_param(const struct context_rmcios *context, 
+                         enum type_rmcios paramtype, 
+                         union param_rmcios param, int index, 
+                         class_rmcios class_func, void *data) ;
+int create_channel_str(const struct context_rmcios *context, 
+                       const char *name, class_rmcios class_func, 
+                       void *data) ;
+int channel_enum(const struct context_rmcios *context, const char *name) ;
+int linked_channels(const struct context_rmcios *context, int id) ;
+
+void write_str(const struct context_rmcios *context, int channel, 
+               const char *string, int sender_id) ;
+void write_buffer(const struct context_rmcios *context, int channel, 
+                  const char *buffer, int length, int sender_id) ;
+void write_f(const struct context_rmcios *context, int channel, 
+             float value) ;
+void write_fv(const struct context_rmcios *context, int channel, 
+              int num_params, float *values) ;
+void write_i(const struct context_rmcios *context, int channel, int value) ;
+
+#endif
@@ -0,0 +1,270 @@
+/* 
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Benchmarks of linux module channels.
+
+   Build from repository root:
+     cc -O2 -Ibench -o bench_linux_channels bench/bench_linux_channels.c \
+        bench/rmcios_stub.c linux_channels.c -lpthread -lm
+   Run:
+     ./bench_linux_channels [--json] [directory_for_test_files]
+
+   Results are printed as CSV (benchmark,metric,value,unit) or JSON.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include "rmcios_stub.h"
+
+void init_gnu_channels(const struct context_rmcios *context) ;
+
+#define CMD(function, channel, ...) do { \
+    const char *params_[]={__VA_ARGS__} ; \
+    stub_command(function, channel, sizeof(params_)/sizeof(*params_), \
+                 params_, NULL, 0) ; \
+} while(0)
+
+static int json=0 ;
+static int results=0 ;
+
+static void result(const char *benchmark, const char *metric, 
+                   double value, const char *unit)
+{
+    if(json)
+    {
+        printf("%s\n  {\"benchmark\": \"%s\", \"metric\": \"%s\", "
+               "\"value\": %.6g, \"unit\": \"%s\"}", 
+               results ? "," : "[", benchmark, metric, value, unit) ;
+    }
+    else 
+    {
+        if(results==0) printf("benchmark,metric,value,unit\n") ;
+        printf("%s,%s,%.6g,%s\n", benchmark, metric, value, unit) ;
+    }
+    results++ ;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts ;
+    clock_gettime(CLOCK_MONOTONIC, &ts) ;
+    return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec ;
+}
+
+// Parse value of key=value from statistics string
+static double stat_value(const char *stats, const char *key)
+{
+    char pattern[32] ;
+    const char *p ;
+    snprintf(pattern, sizeof(pattern), "%s=", key) ;
+    p=strstr(stats, pattern) ;
+    return p ? atof(p+strlen(pattern)) : 0 ;
+}
+
+/////////////////////////////////////////////////////////
+// file channel write throughput
+/////////////////////////////////////////////////////////
+static void bench_file(const char *dir, const char *mode, 
+                       const char *const *setup, int num_setup)
+{
+    const int lines=200000 ;
+    char filename[512] ;
+    char name[64] ;
+    char line[]="2018-01-01T00:00:00+00 1.2345 2.3456 3.4567 4.5678\n" ;
+    const char *params[1] ;
+    uint64_t start, elapsed ;
+    int i ;
+
+    snprintf(name, sizeof(name), "file_%s", mode) ;
+    snprintf(filename, sizeof(filename), "%s/bench_%s.txt", dir, mode) ;
+    unlink(filename) ;
+    CMD(create_rmcios, "file", name) ;
+    if(num_setup>0)
+    {
+        stub_command(setup_rmcios, name, num_setup, setup, NULL, 0) ;
+    }
+    CMD(setup_rmcios, name, filename) ;
+
+    params[0]=line ;
+    start=now_ns() ;
+    for(i=0 ; i<lines ; i++)
+    {
+        stub_command(write_rmcios, name, 1, params, NULL, 0) ;
+    }
+    stub_command(write_rmcios, name, 0, NULL, NULL, 0) ; // flush
+    stub_command(setup_rmcios, name, 0, NULL, NULL, 0) ; // close
+    elapsed=now_ns()-start ;
+    unlink(filename) ;
+
+    snprintf(name, sizeof(name), "file_write_%s", mode) ;
+    result(name, "writes_per_s", lines/(elapsed/1E9), "1/s") ;
+    result(name, "throughput", lines*(sizeof(line)-1)/(elapsed/1E9)/1E6, 
+           "MB/s") ;
+}
+
+/////////////////////////////////////////////////////////
+// rtc_str formatting
+/////////////////////////////////////////////////////////
+static void bench_rtc_str(void)
+{
+    const int calls=1000000 ;
+    char buffer[256] ;
+    uint64_t start, elapsed ;
+    int i ;
+
+    CMD(create_rmcios, "rtc_str", "bench_rtc_str") ;
+    CMD(setup_rmcios, "bench_rtc_str", "%Y-%m-%dT%H:%M:%S%z", "3") ;
+    start=now_ns() ;
+    for(i=0 ; i<calls ; i++)
+    {
+        stub_command(read_rmcios, "bench_rtc_str", 0, NULL, 
+                     buffer, sizeof(buffer)) ;
+    }
+    elapsed=now_ns()-start ;
+    result("rtc_str_read", "calls_per_s", calls/(elapsed/1E9), "1/s") ;
+}
+
+/////////////////////////////////////////////////////////
+// clock read overhead
+/////////////////////////////////////////////////////////
+static void bench_clock(void)
+{
+    const int calls=1000000 ;
+    char buffer[64] ;
+    uint64_t start, elapsed ;
+    int i ;
+
+    CMD(create_rmcios, "clock", "bench_clock") ;
+    CMD(setup_rmcios, "bench_clock", "ns") ;
+    start=now_ns() ;
+    for(i=0 ; i<calls ; i++)
+    {
+        stub_command(read_rmcios, "bench_clock", 0, NULL, 
+                     buffer, sizeof(buffer)) ;
+    }
+    elapsed=now_ns()-start ;
+    result("clock_read", "overhead", (double)elapsed/calls, "ns") ;
+}
+
+/////////////////////////////////////////////////////////
+// timer wake-up latency
+/////////////////////////////////////////////////////////
+static void bench_timer_latency(const char *class_name, const char *period,
+                                int duration_s)
+{
+    char name[64] ;
+    char stats[256] ;
+    const char *params[]={"stats"} ;
+
+    snprintf(name, sizeof(name), "bench_%s", class_name) ;
+    CMD(create_rmcios, class_name, name) ;
+    CMD(setup_rmcios, name, period) ;
+    sleep(duration_s) ;
+    stub_command(read_rmcios, name, 1, params, stats, sizeof(stats)) ;
+    CMD(setup_rmcios, name, "0") ; // Stop
+
+    snprintf(name, sizeof(name), "%s_latency", class_name) ;
+    result(name, "fires", stat_value(stats, "fires"), "count") ;
+    result(name, "missed", stat_value(stats, "missed"), "count") ;
+    result(name, "p50", stat_value(stats, "p50")/1000, "us") ;
+    result(name, "p99", stat_value(stats, "p99")/1000, "us") ;
+    result(name, "max", stat_value(stats, "max")/1000, "us") ;
+}
+
+/////////////////////////////////////////////////////////
+// timer joining a shared kernel timer
+/////////////////////////////////////////////////////////
+// First expiration of timer that joins a running timer of same period 
+// with slack. Must not be earlier than one period after start.
+static void bench_timer_join(void)
+{
+    char stats[256] ;
+    const char *params[]={"stats"} ;
+    uint64_t start ;
+    double first=-1 ;
+
+    CMD(create_rmcios, "timer", "bench_join_a") ;
+    CMD(create_rmcios, "timer", "bench_join_b") ;
+    CMD(setup_rmcios, "bench_join_b", "slack", "0.1") ;
+    CMD(setup_rmcios, "bench_join_a", "0.1") ;
+    usleep(30000) ; // Group expires 70 ms after start of b
+    start=now_ns() ;
+    CMD(setup_rmcios, "bench_join_b", "0.1") ;
+    while(now_ns()-start < 500000000ull)
+    {
+        stub_command(read_rmcios, "bench_join_b", 1, params, 
+                     stats, sizeof(stats)) ;
+        if(stat_value(stats, "fires")>0)
+        {
+            first=(now_ns()-start)/1E6 ;
+            break ;
+        }
+        usleep(200) ;
+    }
+    CMD(setup_rmcios, "bench_join_a", "0") ;
+    CMD(setup_rmcios, "bench_join_b", "0") ;
+
+    result("timer_join", "period", 100, "ms") ;
+    result("timer_join", "first_fire", first, "ms") ;
+    if(first < 100)
+    {
+        fprintf(stderr, "timer_join: first expiration %.3f ms after start "
+                        "is earlier than period\n", first) ;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir="/tmp" ;
+    int i ;
+    for(i=1 ; i<argc ; i++)
+    {
+        if(strcmp(argv[i], "--json")==0) json=1 ;
+        else dir=argv[i] ;
+    }
+
+    init_gnu_channels(&stub_context) ;
+
+    {
+        const char *flush_write[]={"flush", "write"} ;
+        const char *flush_bytes[]={"flush", "bytes", "65536"} ;
+        const char *flush_ms[]={"flush", "ms", "100"} ;
+        const char *flush_manual[]={"flush", "manual"} ;
+        const char *async[]={"async", "1048576"} ;
+        bench_file(dir, "flush_write", flush_write, 2) ;
+        bench_file(dir, "flush_bytes", flush_bytes, 3) ;
+        bench_file(dir, "flush_ms", flush_ms, 3) ;
+        bench_file(dir, "flush_manual", flush_manual, 2) ;
+        bench_file(dir, "async", async, 2) ;
+    }
+    bench_rtc_str() ;
+    bench_clock() ;
+    bench_timer_latency("timer", "0.001", 2) ;
+    bench_timer_latency("rtc_timer", "1", 3) ;
+    bench_timer_join() ;
+
+    if(json) printf("\n]\n") ;
+    return 0 ;
+}
@@ -0,0 +1,332 @@
+/* 
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Minimal in-process RMCIOS context for benchmarking module channels.
+// Channels are kept in a fixed table. Each channel has a list of linked
+// channels that is addressed as its own pseudo channel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RMCIOS-functions.h"
+#include "rmcios_stub.h"
+
+#define STUB_CHANNELS 256
+#define STUB_LINKS 16
+#define STUB_LINK_BASE 0x10000 // Pseudo channel ids of linked channels
+
+struct stub_channel
+{
+    char *name ;
+    class_rmcios class_func ;
+    void *data ;
+    int links[STUB_LINKS] ;
+    int num_links ;
+} ;
+
+static struct stub_channel channels[STUB_CHANNELS] ;
+static int num_channels=1 ; // id 0 is no channel
+
+static void stub_run_channel(const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             union param_rmcios returnv,
+                             int num_params, union param_rmcios param)
+{
+    if(id>=STUB_LINK_BASE)
+    {
+        struct stub_channel *ch ;
+        int i ;
+        id-=STUB_LINK_BASE ;
+        if(id<=0 || id>=num_channels) return ;
+        ch=&channels[id] ;
+        // Linked channels are run through the given context
+        for(i=0 ; i<ch->num_links ; i++)
+        {
+            context->run_channel(context, ch->links[i], function, paramtype,
+                                 returnv, num_params, param) ;
+        }
+        return ;
+    }
+    if(id<=0 || id>=num_channels) return ;
+    channels[id].class_func(channels[id].data, context, id, function,
+                            paramtype, returnv, num_params, param) ;
+}
+
+const struct context_rmcios stub_context={stub_run_channel} ;
+
+/////////////////////////////////////////////////////////
+// Return values
+/////////////////////////////////////////////////////////
+void return_buffer(const struct context_rmcios *context, 
+                   enum type_rmcios paramtype, union param_rmcios returnv,
+                   const char *buffer, int length)
+{
+    char number[32] ;
+    int n ;
+    if(returnv.p==NULL) return ;
+    switch(paramtype)
+    {
+        case buffer_rmcios:
+            n= length<returnv.bv->size ? length : returnv.bv->size ;
+            memcpy(returnv.bv->data, buffer, n) ;
+            returnv.bv->length=n ;
+            returnv.bv->required_size=length ;
+            break ;
+        case int_rmcios:
+        case float_rmcios:
+            n= length<(int)sizeof(number)-1 ? length : sizeof(number)-1 ;
+            memcpy(number, buffer, n) ;
+            number[n]=0 ;
+            if(paramtype==int_rmcios) *returnv.iv=atoi(number) ;
+            else *returnv.fv=atof(number) ;
+            break ;
+        default:
+            break ;
+    }
+}
+
+void return_string(const struct context_rmcios *context, 
+                   enum type_rmcios paramtype, union param_rmcios returnv,
+                   const char *string)
+{
+    return_buffer(context, paramtype, returnv, string, strlen(string)) ;
+}
+
+void return_int(const struct context_rmcios *context, 
+                enum type_rmcios paramtype, union param_rmcios returnv,
+                int value)
+{
+    char buffer[32] ;
+    if(returnv.p==NULL) return ;
+    if(paramtype==int_rmcios) *returnv.iv=value ;
+    else if(paramtype==float_rmcios) *returnv.fv=value ;
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%d", value) ;
+        return_string(context, paramtype, returnv, buffer) ;
+    }
+}
+
+void return_float(const struct context_rmcios *context, 
+                  enum type_rmcios paramtype, union param_rmcios returnv,
+                  float value)
+{
+    char buffer[32] ;
+    if(returnv.p==NULL) return ;
+    if(paramtype==int_rmcios) *returnv.iv=value ;
+    else if(paramtype==float_rmcios) *returnv.fv=value ;
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%g", value) ;
+        return_string(context, paramtype, returnv, buffer) ;
+    }
+}
+
+/////////////////////////////////////////////////////////
+// Parameter conversions
+/////////////////////////////////////////////////////////
+const char *param_to_string(const struct context_rmcios *context, 
+                            enum type_rmcios paramtype, 
+                            union param_rmcios param, int index, 
+                            int maxlen, char *buffer)
+{
+    int n ;
+    if(buffer==NULL || maxlen<=0) return "" ;
+    switch(paramtype)
+    {
+        case int_rmcios:
+            snprintf(buffer, maxlen, "%d", param.iv[index]) ;
+            break ;
+        case float_rmcios:
+            snprintf(buffer, maxlen, "%g", param.fv[index]) ;
+            break ;
+        case buffer_rmcios:
+            n=param.bv[index].length ;
+            if(n>maxlen-1) n=maxlen-1 ;
+            memcpy(buffer, param.bv[index].data, n) ;
+            buffer[n]=0 ;
+            break ;
+        default:
+            buffer[0]=0 ;
+            break ;
+    }
+    return buffer ;
+}
+
+int param_string_length(const struct context_rmcios *context, 
+                        enum type_rmcios paramtype, 
+                        union param_rmcios param, int index)
+{
+    char buffer[32] ;
+    if(paramtype==buffer_rmcios) return param.bv[index].length ;
+    return strlen(param_to_string(context, paramtype, param, index, 
+                                  sizeof(buffer), buffer)) ;
+}
+
+int param_string_alloc_size(const struct context_rmcios *context, 
+                            enum type_rmcios paramtype, 
+                            union param_rmcios param, int index)
+{
+    return param_string_length(context, paramtype, param, index)+1 ;
+}
+
+int param_to_int(const struct context_rmcios *context, 
+                 enum type_rmcios paramtype, union param_rmcios param, 
+                 int index)
+{
+    char buffer[64] ;
+    if(paramtype==int_rmcios) return param.iv[index] ;
+    if(paramtype==float_rmcios) return param.fv[index] ;
+    return atoi(param_to_string(context, paramtype, param, index, 
+                                sizeof(buffer), buffer)) ;
+}
+
+float param_to_float(const struct context_rmcios *context, 
+                     enum type_rmcios paramtype, union param_rmcios param, 
+                     int index)
+{
+    char buffer[64] ;
+    if(paramtype==int_rmcios) return param.iv[index] ;
+    if(paramtype==float_rmcios) return param.fv[index] ;
+    return atof(param_to_string(context, paramtype, param, index, 
+                                sizeof(buffer), buffer)) ;
+}
+
+/////////////////////////////////////////////////////////
+// Channels
+/////////////////////////////////////////////////////////
+int create_channel_str(const struct context_rmcios *context, 
+                       const char *name, class_rmcios class_func, 
+                       void *data)
+{
+    struct stub_channel *ch ;
+    if(num_channels>=STUB_CHANNELS) return 0 ;
+    ch=&channels[num_channels] ;
+    ch->name=strdup(name) ;
+    ch->class_func=class_func ;
+    ch->data=data ;
+    ch->num_links=0 ;
+    return num_channels++ ;
+}
+
+int create_channel_param(const struct context_rmcios *context, 
+                         enum type_rmcios paramtype, 
+                         union param_rmcios param, int index, 
+                         class_rmcios class_func, void *data)
+{
+    char name[64] ;
+    param_to_string(context, paramtype, param, index, sizeof(name), name) ;
+    return create_channel_str(context, name, class_func, data) ;
+}
+
+int channel_enum(const struct context_rmcios *context, const char *name)
+{
+    int i ;
+    for(i=1 ; i<num_channels ; i++)
+    {
+        if(strcmp(channels[i].name, name)==0) return i ;
+    }
+    return 0 ;
+}
+
+int linked_channels(const struct context_rmcios *context, int id)
+{
+    return STUB_LINK_BASE+id ;
+}
+
+/////////////////////////////////////////////////////////
+// Writing to channels
+/////////////////////////////////////////////////////////
+void write_buffer(const struct context_rmcios *context, int channel, 
+                  const char *buffer, int length, int sender_id)
+{
+    struct buffer_rmcios b={(char *)buffer, length, length, 0, 0} ;
+    union param_rmcios param ;
+    param.bv=&b ;
+    context->run_channel(context, channel, write_rmcios, buffer_rmcios,
+                         (union param_rmcios)NULL, 1, param) ;
+}
+
+void write_str(const struct context_rmcios *context, int channel, 
+               const char *string, int sender_id)
+{
+    write_buffer(context, channel, string, strlen(string), sender_id) ;
+}
+
+void write_fv(const struct context_rmcios *context, int channel, 
+              int num_params, float *values)
+{
+    union param_rmcios param ;
+    param.fv=values ;
+    context->run_channel(context, channel, write_rmcios, float_rmcios,
+                         (union param_rmcios)NULL, num_params, param) ;
+}
+
+void write_f(const struct context_rmcios *context, int channel, float value)
+{
+    write_fv(context, channel, 1, &value) ;
+}
+
+void write_i(const struct context_rmcios *context, int channel, int value)
+{
+    union param_rmcios param ;
+    param.iv=&value ;
+    context->run_channel(context, channel, write_rmcios, int_rmcios,
+                         (union param_rmcios)NULL, 1, param) ;
+}
+
+/////////////////////////////////////////////////////////
+// Helpers for benchmarks
+/////////////////////////////////////////////////////////
+int stub_command(enum function_rmcios function, const char *channel,
+                 int num_params, const char *const *params,
+                 char *ret, int ret_size)
+{
+    struct buffer_rmcios b[16] ;
+    struct buffer_rmcios r={ret, 0, ret_size, 0, 0} ;
+    union param_rmcios param, returnv ;
+    int i ;
+    if(num_params>16) num_params=16 ;
+    for(i=0 ; i<num_params ; i++)
+    {
+        b[i].data=(char *)params[i] ;
+        b[i].length=strlen(params[i]) ;
+        b[i].size=b[i].length ;
+    }
+    param.bv=b ;
+    returnv.bv= (ret!=NULL && ret_size>0) ? &r : NULL ;
+    stub_context.run_channel(&stub_context, channel_enum(&stub_context, 
+                                                         channel),
+                             function, buffer_rmcios, returnv, 
+                             num_params, param) ;
+    if(returnv.bv==NULL) return 0 ;
+    if(r.length>=ret_size) r.length=ret_size-1 ;
+    ret[r.length]=0 ;
+    return r.length ;
+}
+
+void stub_link(const char *channel, const char *linked)
+{
+    int id=channel_enum(&stub_context, channel) ;
+    int to=channel_enum(&stub_context, linked) ;
+    if(id==0 || to==0 || channels[id].num_links>=STUB_LINKS) return ;
+    channels[id].links[channels[id].num_links++]=to ;
+}
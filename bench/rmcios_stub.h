@@ -0,0 +1,39 @@
+/* 
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// In-process RMCIOS context for benchmarks (rmcios_stub.c)
+
+#ifndef RMCIOS_STUB_H
+#define RMCIOS_STUB_H
+
+#include "RMCIOS-functions.h"
+
+extern const struct context_rmcios stub_context ;
+
+// Execute function on channel with string parameters. 
+// Returned string is stored to ret. Returns length of returned string.
+int stub_command(enum function_rmcios function, const char *channel,
+                 int num_params, const char *const *params,
+                 char *ret, int ret_size) ;
+
+// Link channel to linked channel
+void stub_link(const char *channel, const char *linked) ;
+
+#endif
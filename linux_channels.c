@@ -27,23 +27,365 @@ You should have received a copy of the GNU General Public Licenses
 along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE /* CPU affinity */
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h> /* offsetof */
+#include <limits.h>
+#include <string.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <math.h> /* modf */
+#include <float.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "RMCIOS-functions.h"
+#include "rmcios_shm.h"
 
 const struct context_rmcios *module_context; 
 
+/////////////////////////////////////////////
+// Event dispatcher                        //
+/////////////////////////////////////////////
+// One thread waits on all registered file descriptors (timerfd:s) with 
+// epoll and runs their handlers from normal thread context.
+struct dispatch_source
+{
+    int fd ;
+    void (*handler)(struct dispatch_source *source) ;
+} ;
+
+static int dispatch_epoll=-1 ;
+static pthread_once_t dispatch_once=PTHREAD_ONCE_INIT ;
+static pthread_t dispatch_thread ;
+static int dispatch_running=0 ;
+
+static void *dispatch_loop(void *data)
+{
+    struct epoll_event events[32] ;
+    int i, n ;
+    (void)data ;
+    for(;;)
+    {
+        n=epoll_wait(dispatch_epoll, events, 32, -1) ;
+        for(i=0 ; i<n ; i++)
+        {
+            struct dispatch_source *source=events[i].data.ptr ;
+            source->handler(source) ;
+        }
+    }
+    return NULL ;
+}
+
+static void dispatch_start(void)
+{
+    pthread_t thread ;
+    sigset_t all, old ;
+
+    dispatch_epoll=epoll_create1(EPOLL_CLOEXEC) ;
+    if(dispatch_epoll<0)
+    {
+        printf("Could not create epoll instance for dispatcher!\r\n") ;
+        return ;
+    }
+    // Keep process signals out of the dispatcher thread:
+    sigfillset(&all) ;
+    pthread_sigmask(SIG_SETMASK, &all, &old) ;
+    if(pthread_create(&thread, NULL, dispatch_loop, NULL)!=0)
+    {
+        printf("Could not start dispatcher thread!\r\n") ;
+    }
+    else 
+    {
+        pthread_detach(thread) ;
+        dispatch_thread=thread ;
+        dispatch_running=1 ;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL) ;
+}
+
+// Register source to the dispatcher. Starts dispatcher on first call.
+int dispatch_add(struct dispatch_source *source)
+{
+    struct epoll_event ev ;
+    pthread_once(&dispatch_once, dispatch_start) ;
+    if(dispatch_epoll<0) return -1 ;
+    ev.events=EPOLLIN ;
+    ev.data.ptr=source ;
+    return epoll_ctl(dispatch_epoll, EPOLL_CTL_ADD, source->fd, &ev) ;
+}
+
+void dispatch_remove(struct dispatch_source *source)
+{
+    if(dispatch_epoll<0) return ;
+    epoll_ctl(dispatch_epoll, EPOLL_CTL_DEL, source->fd, NULL) ;
+}
+
+// Read and return the number of expirations of timerfd source.
+static uint64_t dispatch_expirations(struct dispatch_source *source)
+{
+    uint64_t expirations=0 ;
+    if(read(source->fd, &expirations, sizeof(expirations))
+       !=sizeof(expirations)) return 0 ;
+    return expirations ;
+}
+
+/////////////////////////////////////////////
+// Dispatch thread scheduling
+/////////////////////////////////////////////
+// Scheduling policy, priority and CPU affinity of the threads running 
+// timers (dispatcher and timer workers), and optional memory locking so 
+// that page faults do not delay them.
+static struct
+{
+    pthread_mutex_t lock ;
+    int policy ; // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority ;
+    int pinned ; // cpus is used
+    cpu_set_t cpus ;
+    int locked ; // mlockall done
+    struct dispatch_source prefault ; // eventfd to prefault dispatcher stack
+} dispatch_sched={.lock=PTHREAD_MUTEX_INITIALIZER, .policy=SCHED_OTHER, 
+                  .prefault={-1, NULL}} ;
+
+#define DISPATCH_STACK_PREFAULT (256*1024)
+
+// Touch stack pages that the calling thread may use, so that they are 
+// mapped (and locked) before the time critical path needs them.
+static void dispatch_stack_prefault(void)
+{
+    volatile char stack[DISPATCH_STACK_PREFAULT] ;
+    size_t i ;
+    long page=sysconf(_SC_PAGESIZE) ;
+    for(i=0 ; i<sizeof(stack) ; i+=page) stack[i]=0 ;
+}
+
+static void dispatch_prefault_handler(struct dispatch_source *source)
+{
+    dispatch_expirations(source) ;
+    dispatch_stack_prefault() ;
+}
+
+// Apply configured scheduling to thread.
+static void dispatch_thread_configure(pthread_t thread)
+{
+    struct sched_param sp ;
+    int err ;
+    pthread_mutex_lock(&dispatch_sched.lock) ;
+    sp.sched_priority= dispatch_sched.policy==SCHED_OTHER ? 
+                       0 : dispatch_sched.priority ;
+    err=pthread_setschedparam(thread, dispatch_sched.policy, &sp) ;
+    if(err!=0)
+    {
+        printf("Could not set timer thread scheduling: %s\r\n", 
+               strerror(err)) ;
+    }
+    if(dispatch_sched.pinned)
+    {
+        err=pthread_setaffinity_np(thread, sizeof(cpu_set_t), 
+                                   &dispatch_sched.cpus) ;
+    }
+    else
+    {
+        // All cpus. Kernel limits this to the cpus allowed for the 
+        // process (cpuset), not to the affinity of the calling thread.
+        cpu_set_t all ;
+        long i, n=sysconf(_SC_NPROCESSORS_CONF) ;
+        CPU_ZERO(&all) ;
+        for(i=0 ; i<n && i<CPU_SETSIZE ; i++) CPU_SET(i, &all) ;
+        err=pthread_setaffinity_np(thread, sizeof(cpu_set_t), &all) ;
+    }
+    if(err!=0)
+    {
+        printf("Could not set timer thread CPU affinity: %s\r\n", 
+               strerror(err)) ;
+    }
+    pthread_mutex_unlock(&dispatch_sched.lock) ;
+}
+
+// Parse cpu list such as "0,2-3" to set. Returns number of cpus in set.
+static int dispatch_parse_cpus(const char *list, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus) ;
+    while(*list)
+    {
+        char *end ;
+        long first, last ;
+        first=strtol(list, &end, 10) ;
+        if(end==list) break ;
+        last=first ;
+        if(*end=='-') 
+        {
+            list=end+1 ;
+            last=strtol(list, &end, 10) ;
+            if(end==list) break ;
+        }
+        for( ; first<=last ; first++)
+        {
+            if(first>=0 && first<CPU_SETSIZE) CPU_SET(first, cpus) ;
+        }
+        list=end ;
+        if(*list==',') list++ ;
+        else break ;
+    }
+    return CPU_COUNT(cpus) ;
+}
+
+// Lock all current and future memory of the process and prefault the 
+// stack of the dispatcher thread.
+static void dispatch_memory_lock(int lock)
+{
+    if(!lock)
+    {
+        if(dispatch_sched.locked) munlockall() ;
+        dispatch_sched.locked=0 ;
+        return ;
+    }
+    if(mlockall(MCL_CURRENT | MCL_FUTURE)!=0)
+    {
+        printf("Could not lock memory: %s\r\n", strerror(errno)) ;
+        return ;
+    }
+    dispatch_sched.locked=1 ;
+    dispatch_stack_prefault() ;
+    if(dispatch_sched.prefault.handler==NULL)
+    {
+        dispatch_sched.prefault.fd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+        dispatch_sched.prefault.handler=dispatch_prefault_handler ;
+        if(dispatch_sched.prefault.fd<0 
+           || dispatch_add(&dispatch_sched.prefault)!=0)
+        {
+            printf("Could not prefault dispatcher stack\r\n") ;
+            return ;
+        }
+    }
+    {
+        uint64_t one=1 ;
+        if(write(dispatch_sched.prefault.fd, &one, sizeof(one))<0) return ;
+    }
+}
+
 /////////////////////////////////////////////
 // RTC - Real time clock                   //
 /////////////////////////////////////////////
 int timezone_offset=0 ; // Timezone offset(seconds) from UTC
 char use_localtime=1 ; // Flag to use local time
 
+// Utility function determine local time offset from gmt
+static long tz_offset_compute(time_t t) {
+    struct tm local, utc ;
+    localtime_r(&t, &local);
+    gmtime_r(&t, &utc);
+    long diff = ((local.tm_hour - utc.tm_hour) * 60L
+                + (local.tm_min - utc.tm_min)) * 60L 
+                + (local.tm_sec - utc.tm_sec) ;
+    int delta_day = local.tm_mday - utc.tm_mday;
+    if ((delta_day == 1) || (delta_day < -1)) {
+        diff += 24L * 60 * 60;
+    } else if ((delta_day == -1) || (delta_day > 1)) {
+        diff -= 24L * 60 * 60;
+    }
+    return diff;
+}
+
+// Cached local time offset. Valid from valid_from until next offset change
+// (DST transition) at valid_until. Protected by sequence counter.
+static struct 
+{
+    unsigned int seq ;
+    long offset ;
+    time_t valid_from ;
+    time_t valid_until ;
+} tz_cache ;
+
+static void tz_cache_invalidate(void)
+{
+    unsigned int seq = __atomic_load_n(&tz_cache.seq, __ATOMIC_RELAXED) ;
+    // Take the cache from even sequence like the updater does. Wait for
+    // running update to complete.
+    while ((seq & 1) != 0 ||
+           !__atomic_compare_exchange_n(&tz_cache.seq, &seq, seq + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        if (seq & 1)
+        {
+            sched_yield() ;
+            seq = __atomic_load_n(&tz_cache.seq, __ATOMIC_RELAXED) ;
+        }
+    }
+    tz_cache.valid_until = 0 ;
+    __atomic_store_n(&tz_cache.seq, seq + 2, __ATOMIC_RELEASE) ;
+}
+
+// Find first time after t when the local time offset changes.
+static time_t tz_next_transition(time_t t, long offset)
+{
+    const time_t day = 24L * 60 * 60 ;
+    time_t before = t, after = t ;
+    int i ;
+    for (i = 0 ; i < 366 ; i++)
+    {
+        after = before + day ;
+        if (tz_offset_compute(after) != offset) break ;
+        before = after ;
+    }
+    if (i == 366) return after ; // No transitions within a year
+    while (after - before > 1)
+    {
+        time_t middle = before + (after - before) / 2 ;
+        if (tz_offset_compute(middle) == offset) before = middle ;
+        else after = middle ;
+    }
+    return after ;
+}
+
+long tz_offset_second(time_t t) {
+    unsigned int seq = __atomic_load_n(&tz_cache.seq, __ATOMIC_ACQUIRE) ;
+    long offset ;
+    if ((seq & 1) == 0)
+    {
+        int valid = t >= tz_cache.valid_from && t < tz_cache.valid_until ;
+        offset = tz_cache.offset ;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+        if (valid && __atomic_load_n(&tz_cache.seq, __ATOMIC_RELAXED) == seq)
+        {
+            return offset ;
+        }
+    }
+
+    // Recompute. Only one thread updates the cache at a time.
+    if ((seq & 1) == 0 &&
+        __atomic_compare_exchange_n(&tz_cache.seq, &seq, seq + 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        tzset() ;
+        offset = tz_offset_compute(t) ;
+        tz_cache.offset = offset ;
+        tz_cache.valid_from = t ;
+        tz_cache.valid_until = tz_next_transition(t, offset) ;
+        __atomic_store_n(&tz_cache.seq, seq + 2, __ATOMIC_RELEASE) ;
+        return offset ;
+    }
+    return tz_offset_compute(t) ;
+}
+
 void rtc_class_func(void *data, const struct context_rmcios *context, 
                     int id, enum function_rmcios function,
                     int paramtype,union param_rmcios returnv, 
@@ -59,12 +401,19 @@ void rtc_class_func(void *data, const struct context_rmcios *context,
                  "rtc (realtime clock) channel help :\r\n"
                  " setup rtc timezone_offset(hours) year month day\r\n"
                  "                                  hour minute second\r\n"
+                 " setup rtc #use system local time zone (default)\r\n"
                  " read rtc #read time in unix time\r\n"
                  " write rtc unixtime #set UTC time in unix time\r\n"
                  );
          break ;
      case setup_rmcios:
-         if(num_params<1)  break ;
+         tz_cache_invalidate() ;
+         if(num_params<1)  
+         {
+             timezone_offset=0 ;
+             use_localtime=1 ;
+             break ;
+         }
          timezone_offset=param_to_int(context, 
                  paramtype,
                  param, 0)*60*60 ; 
@@ -79,115 +428,249 @@ void rtc_class_func(void *data, const struct context_rmcios *context,
  }
 }
 
-// Utility function determine local time offset from gmt
-long tz_offset_second(time_t t) {
-    struct tm local = *localtime(&t);
-    struct tm utc = *gmtime(&t);
-    long diff = ((local.tm_hour - utc.tm_hour) * 60L
-                + (local.tm_min - utc.tm_min)) * 60L 
-                + (local.tm_sec - utc.tm_sec) ;
-    int delta_day = local.tm_mday - utc.tm_mday;
-    if ((delta_day == 1) || (delta_day < -1)) {
-        diff += 24L * 60 * 60;
-    } else if ((delta_day == -1) || (delta_day > 1)) {
-        diff -= 24L * 60 * 60;
-    }
-    return diff;
-}
-
-// Utility function for printing current time.
-// Adds second decimals.
-// Uses %z to insert ISO8601 timezone.
-void print_current_time(char* buffer, int buffer_length, 
-                        const char *format, int second_decimals,
-                        int timezone_offset)
+// Timezone offset to use at time t
+static long current_tz_offset(time_t t, long timezone_offset)
 {
-    int i=0 ;
-    struct timeval curTime;
-    gettimeofday(&curTime, NULL);
+    if(use_localtime==1) return tz_offset_second(t) ;
+    return timezone_offset ;
+}
 
-    time_t rawtime;
-    struct tm * timeinfo;
+// Time format compiled to list of operations.
+// Rendered string of the latest second is cached. Only second decimals 
+// are updated on each print within the same second.
+#define TIME_FORMAT_OPS 32
+#define TIME_FORMAT_LEN 256
+#define TIME_FORMAT_PATCHES 8
 
-    int seconds ; 
-    seconds= curTime.tv_sec%60 ;
+enum time_format_op
+{
+    time_op_strftime, // strftime segment in text
+    time_op_seconds,  // Seconds with decimals
+    time_op_timezone  // ISO 8601 timezone offset
+} ;
 
-    int parts ;
-    int parts_precision=1 ;
-    for(i=0;i<second_decimals;i++) parts_precision*=10 ; 
-    parts = curTime.tv_usec / (1E6/(parts_precision) ) ;
+struct time_format
+{
+    int second_decimals ;
+    int num_ops ;
+    struct 
+    {
+        enum time_format_op type ;
+        int text ; // Offset of strftime segment in text
+    } ops[TIME_FORMAT_OPS] ;
+    char text[TIME_FORMAT_LEN+TIME_FORMAT_OPS] ; // nul separated segments
 
-    time(&rawtime);
-    if(use_localtime==1) timezone_offset=tz_offset_second(rawtime) ;
-    rawtime+=timezone_offset ;
-    timeinfo = gmtime(&rawtime) ;
+    // Cache protected by sequence counter (odd=being updated)
+    unsigned int seq ; 
+    time_t cache_second ;
+    long cache_offset ;
+    int cache_len ;
+    int num_patches ; 
+    int patches[TIME_FORMAT_PATCHES] ; // Positions of second decimals
+    char cache[TIME_FORMAT_LEN] ;
+} ;
 
-    char format_buffer[buffer_length] ;
+// Compile strftime format with %S seconds decimals and %z timezone.
+void time_format_compile(struct time_format *tf, const char *format,
+                         int second_decimals)
+{
     const char *c=format ;
-
-    for(i=0; i<(buffer_length-1) && *c!=0 ; i++ )
+    int t=0 ;
+    int segment=0 ; // Currently in strftime segment
+    if(second_decimals>9) second_decimals=9 ;
+    if(second_decimals<0) second_decimals=0 ;
+    tf->second_decimals=second_decimals ;
+    tf->num_ops=0 ;
+    tf->seq=0 ;
+    tf->cache_second=-1 ;
+    for( ; *c!=0 && tf->num_ops<TIME_FORMAT_OPS-1 
+           && t<TIME_FORMAT_LEN-3 ; c++)
     {
+        enum time_format_op type=time_op_strftime ;
+        if(*c=='%' && c[1]=='S' && second_decimals>0) type=time_op_seconds ;
+        else if(*c=='%' && c[1]=='z') type=time_op_timezone ;
 
-        if(*c=='%') // Specifier
+        if(type!=time_op_strftime)
         {
+            if(segment) tf->text[t++]=0 ;
+            segment=0 ;
+            tf->ops[tf->num_ops++].type=type ;
             c++ ;
-            if(*c==0) break ;
-            if(*c=='S' && second_decimals>0) // Insert precision seconds
-            {
-                char sseconds[128] ;
-                char sformat[128] ;
-                snprintf(sformat, sizeof(sformat),
-                         "%%02d.%%0%dd", second_decimals) ;
-                snprintf(sseconds, sizeof(sseconds),
-                         sformat,seconds,parts) ;
-                strncpy(format_buffer+i, sseconds, 
-                        sizeof(format_buffer)-i-1 ) ;
-                i+=strlen(sseconds)-1 ;
-            }
-            else if(*c=='z') // Insert ISO 8601 timezone offset
-            {
-                char sign='+' ;
-                if(timezone_offset<0) 
+            continue ;
+        }
+        if(!segment)
+        {
+            tf->ops[tf->num_ops].type=time_op_strftime ;
+            tf->ops[tf->num_ops++].text=t ;
+            segment=1 ;
+        }
+        tf->text[t++]=*c ;
+        if(*c=='%' && c[1]!=0) tf->text[t++]=*++c ; // Keep specifier whole
+    }
+    tf->text[t]=0 ;
+}
+
+// Render format for given second. Records positions of second decimals.
+static int time_format_render(struct time_format *tf, char *buffer, 
+                              int buffer_length, time_t second, long offset,
+                              int *patches, int *num_patches)
+{
+    int i, len=0 ;
+    time_t rawtime=second+offset ;
+    struct tm timeinfo ;
+    gmtime_r(&rawtime, &timeinfo) ;
+    *num_patches=0 ;
+    buffer[0]=0 ;
+    for(i=0 ; i<tf->num_ops && len<buffer_length-1 ; i++)
+    {
+        int space=buffer_length-len ;
+        switch(tf->ops[i].type)
+        {
+            case time_op_strftime:
+                len+=strftime(buffer+len, space, tf->text+tf->ops[i].text, 
+                              &timeinfo) ;
+                break ;
+
+            case time_op_seconds: // Insert precision seconds
+                if(space<=3+tf->second_decimals) 
                 {
-                    timezone_offset=-1*timezone_offset ;
-                    sign='-' ;
+                    i=tf->num_ops ;
+                    break ;
                 }
-                i += snprintf(format_buffer+i, 
-                              sizeof(format_buffer)-i-1, 
-                              "%c%02d",sign, 
-                              timezone_offset/60/60 );
-                int minutes=timezone_offset/60%60 ;
-                if(minutes>0)
+                len+=snprintf(buffer+len, space, "%02d.", timeinfo.tm_sec);
+                if(*num_patches<TIME_FORMAT_PATCHES)
                 {
-                    i += snprintf(format_buffer+i, 
-                                  sizeof(format_buffer)-i-1 , 
-                                  ":%02d", timezone_offset/60%60 );
+                    patches[(*num_patches)++]=len ;
+                }
+                memset(buffer+len, '0', tf->second_decimals) ;
+                len+=tf->second_decimals ;
+                buffer[len]=0 ;
+                break ;
 
+            case time_op_timezone: // Insert ISO 8601 timezone offset
+                {
+                    long tz=offset ;
+                    char sign='+' ;
+                    int n ;
+                    if(tz<0) 
+                    {
+                        tz=-tz ;
+                        sign='-' ;
+                    }
+                    if(tz/60%60>0)
+                    {
+                        n=snprintf(buffer+len, space, "%c%02ld:%02ld", 
+                                   sign, tz/60/60, tz/60%60) ;
+                    }
+                    else n=snprintf(buffer+len, space, "%c%02ld", 
+                                    sign, tz/60/60) ;
+                    len+= n<space ? n : space-1 ;
                 }
-                i-- ;
-            }
-            else // Continue normally
-            {
-                c-- ;
-                format_buffer[i]=*c ;
-            }
+                break ;
         }
-        else
+    }
+    return len ;
+}
+
+// Print time now to buffer. Returns length of printed string.
+int time_format_print(struct time_format *tf, char *buffer, 
+                      int buffer_length, const struct timespec *now, 
+                      long timezone_offset)
+{
+    int i, len=-1 ;
+    int patches[TIME_FORMAT_PATCHES] ;
+    int num_patches=0 ;
+    unsigned int seq ;
+    long offset=current_tz_offset(now->tv_sec, timezone_offset) ;
+
+    if(buffer_length<=0) return 0 ;
+    // Copy from cache when it has the current second
+    seq=__atomic_load_n(&tf->seq, __ATOMIC_ACQUIRE) ;
+    if((seq&1)==0 && tf->cache_second==now->tv_sec 
+       && tf->cache_offset==offset && tf->cache_len<buffer_length)
+    {
+        len=tf->cache_len ;
+        num_patches=tf->num_patches ;
+        memcpy(patches, tf->patches, sizeof(patches)) ;
+        memcpy(buffer, tf->cache, len+1) ;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+        if(__atomic_load_n(&tf->seq, __ATOMIC_RELAXED)!=seq) len=-1 ;
+    }
+
+    if(len<0)
+    {
+        len=time_format_render(tf, buffer, buffer_length, now->tv_sec, 
+                               offset, patches, &num_patches) ;
+        // Update cache unless another thread is updating it
+        if(len<TIME_FORMAT_LEN && (seq&1)==0 &&
+           __atomic_compare_exchange_n(&tf->seq, &seq, seq+1, 0, 
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
         {
-            format_buffer[i]=*c ;
+            tf->cache_second=now->tv_sec ;
+            tf->cache_offset=offset ;
+            tf->cache_len=len ;
+            tf->num_patches=num_patches ;
+            memcpy(tf->patches, patches, sizeof(patches)) ;
+            memcpy(tf->cache, buffer, len+1) ;
+            __atomic_store_n(&tf->seq, seq+2, __ATOMIC_RELEASE) ;
         }
-        c++ ;
     }
-    format_buffer[i]=0 ;
-    strftime(buffer, buffer_length, format_buffer , timeinfo);
+
+    // Patch second decimals:
+    if(num_patches>0)
+    {
+        char digits[10] ;
+        long parts=now->tv_nsec ;
+        for(i=tf->second_decimals ; i<9 ; i++) parts/=10 ;
+        for(i=tf->second_decimals-1 ; i>=0 ; i--)
+        {
+            digits[i]='0'+parts%10 ;
+            parts/=10 ;
+        }
+        for(i=0 ; i<num_patches ; i++)
+        {
+            if(patches[i]+tf->second_decimals<=len)
+            {
+                memcpy(buffer+patches[i], digits, tf->second_decimals) ;
+            }
+        }
+    }
+    return len ;
+}
+
+// Utility function for printing current time.
+// Adds second decimals.
+// Uses %z to insert ISO8601 timezone.
+// Format is compiled again only when it differs from the previous call in
+// the same thread.
+void print_current_time(char* buffer, int buffer_length, 
+                        const char *format, int second_decimals,
+                        int timezone_offset)
+{
+    static __thread struct time_format tf ;
+    static __thread char compiled[TIME_FORMAT_LEN] ; // Source of tf
+    static __thread int compiled_decimals ;
+    static __thread int valid=0 ;
+    struct timespec now ;
+    if(!valid || compiled_decimals!=second_decimals 
+       || strcmp(compiled, format)!=0)
+    {
+        time_format_compile(&tf, format, second_decimals) ;
+        // Too long format is compiled on every call
+        valid= strlen(format)<sizeof(compiled) ;
+        if(valid) strcpy(compiled, format) ;
+        compiled_decimals=second_decimals ;
+    }
+    clock_gettime(CLOCK_REALTIME, &now) ;
+    time_format_print(&tf, buffer, buffer_length, &now, timezone_offset) ;
 }
 
 struct rtc_str_data
 {
     char rtc_str_format[256]  ;
-    char rtc_str_prev[512] ;
     int second_decimals ;
-} default_rtc_str_data= {"%Y-%m-%dT%H:%M:%S%z","",0} ;
+    struct time_format compiled ;
+} default_rtc_str_data= {"%Y-%m-%dT%H:%M:%S%z", 0, {0}} ;
 
 void rtc_str_class_func(struct rtc_str_data *this, 
                         const struct context_rmcios *context, 
@@ -196,10 +679,8 @@ void rtc_str_class_func(struct rtc_str_data *this,
                         union param_rmcios returnv, 
                         int num_params,union param_rmcios param)
 {
- int i;
- int writelen ;
  char buffer[256] ;
- time_t seconds=time(NULL)+timezone_offset ;
+ struct timespec now ;
  switch(function)
  {
      case help_rmcios:
@@ -238,8 +719,9 @@ void rtc_str_class_func(struct rtc_str_data *this,
 
          //default values :
          strcpy(this->rtc_str_format,"%Y-%m-%dT%H:%M:%S%z") ;
-         this->rtc_str_prev[0]=0 ;
          this->second_decimals=0 ;
+         time_format_compile(&this->compiled, this->rtc_str_format, 
+                             this->second_decimals) ;
          break ;
 
      case setup_rmcios:
@@ -250,20 +732,22 @@ void rtc_str_class_func(struct rtc_str_data *this,
                  sizeof(this->rtc_str_format), 
                  this->rtc_str_format) ;
 
-         if(num_params<2) break ;
-
-         this->second_decimals=param_to_int(context, 
-                 paramtype,
-                 param,1) ;
+         if(num_params>1) 
+         {
+             this->second_decimals=param_to_int(context, 
+                     paramtype,
+                     param,1) ;
+         }
+         time_format_compile(&this->compiled, this->rtc_str_format, 
+                             this->second_decimals) ;
          break ;
 
      case write_rmcios:
          {
              if(this==NULL) break ;
-             print_current_time(buffer,sizeof(buffer), 
-                     this->rtc_str_format, 
-                     this->second_decimals, 
-                     timezone_offset ) ;
+             clock_gettime(CLOCK_REALTIME, &now) ;
+             time_format_print(&this->compiled, buffer, sizeof(buffer),
+                               &now, timezone_offset) ;
              write_str(context, linked_channels(context, id), buffer, 0) ;
              return_string(context, paramtype, returnv, buffer) ;
              break ;
@@ -272,10 +756,9 @@ void rtc_str_class_func(struct rtc_str_data *this,
      case read_rmcios:
          {
              if(this==NULL) break ;
-             print_current_time(buffer,sizeof(buffer), 
-                     this->rtc_str_format, 
-                     this->second_decimals, 
-                     timezone_offset) ;
+             clock_gettime(CLOCK_REALTIME, &now) ;
+             time_format_print(&this->compiled, buffer, sizeof(buffer),
+                               &now, timezone_offset) ;
              return_string(context, paramtype,
                      returnv,buffer) ;
              break ;
@@ -286,272 +769,5246 @@ void rtc_str_class_func(struct rtc_str_data *this,
 ///////////////////////////////////////////////////////
 // Standard C file flass
 ///////////////////////////////////////////////////////
+enum file_flush_policy
+{
+    flush_write,  // Flush after every write
+    flush_bytes,  // Flush when flush_limit bytes has been written
+    flush_time,   // Flush every flush_limit milliseconds
+    flush_manual  // Flush only on empty write
+} ;
+
+enum file_overflow_policy
+{
+    overflow_block,       // Wait for space in the queue
+    overflow_drop_oldest, // Discard oldest queued data
+    overflow_drop_newest  // Discard data being written
+} ;
+
+enum file_compression
+{
+    compress_none,
+    compress_gzip, // Concatenated gzip members (needs HAVE_ZLIB)
+    compress_zstd  // Concatenated zstd frames (needs HAVE_ZSTD)
+} ;
+
+// Compression stage of asynchronous writer. Data is compressed in 
+// independent blocks, so each completed block can be decompressed even
+// if the rest of the file is lost.
+struct file_compressor
+{
+    enum file_compression type ;
+    int level ;
+    char *in ; // Block being collected
+    size_t in_len ;
+    size_t block_size ;
+    char *out ;
+    size_t out_size ;
+    uint64_t bytes_in ;
+    uint64_t bytes_out ;
+#ifdef HAVE_ZLIB
+    z_stream z ;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd ;
+#endif
+} ;
+
+// Previous file of rotation waiting to be closed
+struct file_retired
+{
+    FILE *f ;
+    char *buffer ; // stdio buffer
+    int sync ; // fdatasync before closing
+    struct file_retired *next ;
+} ;
+
+// Change of file on rotation queued to asynchronous writer
+struct file_switch
+{
+    uint64_t pos ; // Data before pos goes to the previous file
+    int fd ; // File after pos
+    struct file_retired retired ; // Closed by writer thread after switch
+    struct file_switch *next ;
+} ;
+
+// Queue of asynchronous file writer.
+// Byte ring with free running positions. Writers hold the file lock, the
+// writer thread drains without locking. On drop_oldest overflow writers 
+// advance tail, and the writer thread copies data out and validates the 
+// copy against tail before writing it.
+struct file_ring
+{
+    char *data ;
+    uint64_t size ;
+    uint64_t head ; // Next write position
+    uint64_t tail ; // Next drain position
+    uint64_t drained ; // End of data given to output (writer thread only)
+    uint64_t written ; // End of data written to file, not in compressor
+    enum file_overflow_policy overflow ;
+    char *chunk ; // Copy buffer for drop_oldest
+    struct file_compressor *compressor ; // NULL for uncompressed output
+    int fd ;
+    // Changes of file on rotation, oldest first. List under wait_lock.
+    int switch_pending ; // Switches in list
+    struct file_switch *switches ;
+    pthread_t thread ;
+    pthread_mutex_t wait_lock ;
+    pthread_cond_t data_cond ;
+    pthread_cond_t space_cond ;
+    pthread_cond_t written_cond ; // Signaled when written advances
+    int written_waiters ; // Threads waiting on written_cond
+    int exited ; // Writer thread has finished, under wait_lock
+    int writer_waiting ; // Writer thread sleeps on data_cond
+    int producer_waiting ; // Producer sleeps on space_cond
+    int flush_request ;
+    int stop ;
+    // Statistics:
+    uint64_t dropped ;
+    uint64_t high_water ;
+} ;
+
+#define FILE_RING_CHUNK 65536
+
 struct file_data
 {
     FILE *f ;
     unsigned int id; 
-} fconout={NULL,0,0}, fconin={NULL,0,0};
+    pthread_mutex_t lock ; // Protects f against close while writing
+    enum file_flush_policy flush_policy ;
+    long flush_limit ;
+    long unflushed ; // Bytes written after last flush
+    int buffer_size ; // stdio buffer size, 0=default 
+    char *buffer ; 
+    struct dispatch_source flush_timer ; // Timer for flush_time policy
+    int flush_pending ; // Flush timer found the channel locked
+    int async_size ; // Asynchronous write queue size, 0=synchronous
+    enum file_overflow_policy overflow ;
+    struct file_ring *ring ; // Queue of running asynchronous writer
+    char *filename ; // Name of opened file
+    enum file_compression compression ;
+    int compress_level ;
+    int compress_block ; // Uncompressed bytes per compressed block
+    struct file_rotation *rotation ; // NULL when not rotating
+    struct file_sync *sync ; // Background fdatasync, NULL when off
+    struct file_stamp *stamp ; // Timestamp prefix, NULL when off
+    int row ; // Write all numbers of numeric write as row
+    char row_separator[8] ; // Between numbers of numeric write
+    int row_newline ; // End numeric write with newline, -1=multiple values
+} fconout ;
 
-void file_class_func(struct file_data *this, 
-                     const struct context_rmcios *context, 
-                     int id, enum type_rmcios function,
-                     int paramtype,union param_rmcios returnv, 
-                     int num_params,union param_rmcios param)
+static void file_data_init(struct file_data *this)
 {
-const char *s ;
-int plen ;
-switch(function)
+    this->f=NULL ;
+    this->id=0 ;
+    pthread_mutex_init(&this->lock, NULL) ;
+    this->flush_policy=flush_write ;
+    this->flush_limit=0 ;
+    this->unflushed=0 ;
+    this->buffer_size=0 ;
+    this->buffer=NULL ;
+    this->flush_timer.fd=-1 ;
+    this->flush_timer.handler=NULL ;
+    this->flush_pending=0 ;
+    this->async_size=0 ;
+    this->overflow=overflow_block ;
+    this->ring=NULL ;
+    this->filename=NULL ;
+    this->compression=compress_none ;
+    this->compress_level=-1 ;
+    this->compress_block=1024*1024 ;
+    this->rotation=NULL ;
+    this->sync=NULL ;
+    this->stamp=NULL ;
+    this->row=0 ;
+    strcpy(this->row_separator, ",") ;
+    this->row_newline=-1 ;
+}
+
+// Compare string parameter to keyword
+static int param_is_keyword(const struct context_rmcios *context, 
+                            int paramtype, union param_rmcios param, 
+                            int index, const char *keyword)
 {
-    case help_rmcios:
-        return_string(context,paramtype,returnv,
-                      "file channel help\r\n"
-                      " create file ch_name\r\n"
-                      " setup ch_name filename | mode=a" 
-                      " setup ch_name \r\n #Close file \r\n"
-                      " write ch_name file data # write data to file\r\n"
-                      " link ch_name filename\r\n"
-                      " read file filename\r\n"
-                      );
-        break ;
+    char buffer[16] ;
+    param_to_string(context, paramtype, param, index, 
+                    sizeof(buffer), buffer) ;
+    return strcmp(buffer, keyword)==0 ;
+}
 
-    case create_rmcios:
-        if(num_params<1) break ;
+// Convert parameter to double. Strings are parsed to full precision.
+static double param_to_double(const struct context_rmcios *context, 
+                              int paramtype, union param_rmcios param, 
+                              int index)
+{
+    char buffer[64] ;
+    if(paramtype==int_rmcios || paramtype==float_rmcios)
+    {
+        return param_to_float(context, paramtype, param, index) ;
+    }
+    param_to_string(context, paramtype, param, index, 
+                    sizeof(buffer), buffer) ;
+    return strtod(buffer, NULL) ;
+}
 
-        this=  (struct file_data *) malloc(sizeof( struct file_data)) ; 
-        this->id=create_channel_param(context, paramtype, param, 0,
-                                      (class_rmcios)file_class_func, 
-                                      this ) ;
-        this->f=NULL ;
+// Convert seconds parameter to nanoseconds. Integers and decimal text 
+// such as "0.1" are converted exactly. Float parameters are float32, so 
+// the result is approximate.
+static int64_t param_to_ns(const struct context_rmcios *context, 
+                           int paramtype, union param_rmcios param, 
+                           int index)
+{
+    char buffer[64] ;
+    const char *c ;
+    int64_t sec=0, frac=0 ;
+    int digits=0, negative=0 ;
+    if(paramtype==int_rmcios) return param.iv[index]*1000000000LL ;
+    if(paramtype==float_rmcios) return llround(param.fv[index]*1E9) ;
+    param_to_string(context, paramtype, param, index, 
+                    sizeof(buffer), buffer) ;
+    c=buffer ;
+    while(*c==' ') c++ ;
+    if(*c=='-' || *c=='+') negative=*c++=='-' ;
+    for( ; *c>='0' && *c<='9' && sec<1000000000 ; c++) sec=sec*10+*c-'0' ;
+    if(*c=='.') 
+    {
+        for(c++ ; *c>='0' && *c<='9' ; c++)
+        {
+            if(digits<9) 
+            {
+                frac=frac*10+*c-'0' ;
+                digits++ ;
+            }
+        }
+    }
+    if(*c!=0 && *c!=' ') 
+    {
+        // Exponent or too large
+        return llround(strtod(buffer, NULL)*1E9) ;
+    }
+    for( ; digits<9 ; digits++) frac*=10 ;
+    return negative ? -(sec*1000000000LL+frac) : sec*1000000000LL+frac ;
+}
+
+// Number formatting for numeric writes
+static const char digit_pairs[201]=
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899" ;
+
+// Print unsigned integer two digits at a time. Returns length.
+static int format_uint(char *buffer, uint64_t value)
+{
+    char digits[20] ;
+    char *p=digits+sizeof(digits) ;
+    int len ;
+    while(value>=100)
+    {
+        p-=2 ;
+        memcpy(p, digit_pairs+(value%100)*2, 2) ;
+        value/=100 ;
+    }
+    if(value>=10) 
+    {
+        p-=2 ;
+        memcpy(p, digit_pairs+value*2, 2) ;
+    }
+    else *--p='0'+value ;
+    len=digits+sizeof(digits)-p ;
+    memcpy(buffer, p, len) ;
+    return len ;
+}
+
+static int format_int(char *buffer, int64_t value)
+{
+    if(value<0) 
+    {
+        *buffer='-' ;
+        return 1+format_uint(buffer+1, -(uint64_t)value) ;
+    }
+    return format_uint(buffer, value) ;
+}
+
+// value*10^n. Exact for |n|<=22 when value*10^n is representable.
+static double scale10(double value, int n)
+{
+    static const double powers[23]={
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 
+    } ;
+    while(n>22) 
+    {
+        value*=powers[22] ;
+        n-=22 ;
+    }
+    while(n<-22) 
+    {
+        value/=powers[22] ;
+        n+=22 ;
+    }
+    return n>=0 ? value*powers[n] : value/powers[-n] ;
+}
+
+// Check that decimal d*10^n10 reads back as value
+static int float_round_trips(uint64_t d, int n10, float value)
+{
+    char text[32] ;
+    snprintf(text, sizeof(text), "%" PRIu64 "e%d", d, n10) ;
+    return strtof(text, NULL)==value ;
+}
+
+// Print float with the fewest significant digits that read back to the 
+// same float. Candidates are checked against the midpoints to neighbour 
+// floats in double. Candidates that are not exact in double and fall 
+// close to a midpoint are checked by reading them back. Returns length.
+static int format_float(char *buffer, float value)
+{
+    double v=value, ulp, low, high, margin ;
+    uint64_t digits=0 ;
+    int exp10, e, p, n, len=0, even ;
+    char text[10] ;
+
+    if(isnan(value)) 
+    {
+        memcpy(buffer, "nan", 3) ;
+        return 3 ;
+    }
+    if(signbit(value)) 
+    {
+        buffer[len++]='-' ;
+        v=-v ;
+    }
+    if(isinf(value)) 
+    {
+        memcpy(buffer+len, "inf", 3) ;
+        return len+3 ;
+    }
+    if(v==0)
+    {
+        buffer[len++]='0' ;
+        return len ;
+    }
+
+    // Interval of reals that round to value
+    frexp(v, &e) ;
+    ulp= v<FLT_MIN ? ldexp(1.0, FLT_MIN_EXP-FLT_MANT_DIG) 
+                   : ldexp(1.0, e-FLT_MANT_DIG) ;
+    high=v+ulp/2 ;
+    low= (v>FLT_MIN && frexp(v, &e)==0.5) ? v-ulp/4 : v-ulp/2 ;
+    margin=v*0x1p-46 ;
+    even= ((uint64_t)ldexp(v, -(int)log2(ulp)) & 1)==0 ; // Ties round here
+
+    // 9 significant digits always round trip
+    exp10=(int)floor(log10(v)) ;
+    digits=llround(scale10(v, 8-exp10)) ;
+    if(digits>=1000000000ull) 
+    {
+        exp10++ ;
+        digits=llround(scale10(v, 8-exp10)) ;
+    }
+    else if(digits<100000000ull) 
+    {
+        exp10-- ;
+        digits=llround(scale10(v, 8-exp10)) ;
+    }
+
+    // Shortest rounding that stays within the interval
+    for(p=1 ; p<9 ; p++)
+    {
+        uint64_t d=llround(scale10(v, p-1-exp10)) ;
+        int n10=exp10-p+1 ;
+        double candidate=scale10((double)d, n10) ;
+        if(n10>=0 && n10<=22 && candidate<0x1p53)
+        {
+            // Exact candidate: midpoints are included for even value
+            if(even ? (candidate>=low && candidate<=high)
+                    : (candidate>low && candidate<high))
+            {
+                digits=d ;
+                break ;
+            }
+        }
+        else if(candidate>low+margin && candidate<high-margin)
+        {
+            digits=d ;
+            break ;
+        }
+        else if(candidate>low-margin && candidate<high+margin
+                && float_round_trips(d, n10, (float)v))
+        {
+            digits=d ;
+            break ;
+        }
+    }
+    n=format_uint(text, digits) ;
+    if(n>p) exp10++ ; // Rounded up to next power of ten
+    while(n>1 && text[n-1]=='0') n-- ;
+
+    if(exp10>=-5 && exp10<9)
+    {
+        if(exp10<0)
+        {
+            buffer[len++]='0' ;
+            buffer[len++]='.' ;
+            for(e=-1 ; e>exp10 ; e--) buffer[len++]='0' ;
+            memcpy(buffer+len, text, n) ;
+            len+=n ;
+        }
+        else if(n<=exp10+1)
+        {
+            memcpy(buffer+len, text, n) ;
+            len+=n ;
+            for( ; n<=exp10 ; n++) buffer[len++]='0' ;
+        }
+        else
+        {
+            memcpy(buffer+len, text, exp10+1) ;
+            len+=exp10+1 ;
+            buffer[len++]='.' ;
+            memcpy(buffer+len, text+exp10+1, n-exp10-1) ;
+            len+=n-exp10-1 ;
+        }
+        return len ;
+    }
+    buffer[len++]=text[0] ;
+    if(n>1)
+    {
+        buffer[len++]='.' ;
+        memcpy(buffer+len, text+1, n-1) ;
+        len+=n-1 ;
+    }
+    buffer[len++]='e' ;
+    buffer[len++]= exp10<0 ? '-' : '+' ;
+    if(exp10<0) exp10=-exp10 ;
+    if(exp10<10) buffer[len++]='0' ;
+    return len+format_uint(buffer+len, exp10) ;
+}
+
+// Wake up the writer thread. 
+static void file_ring_kick(struct file_ring *ring, int flush)
+{
+    if(flush) __atomic_store_n(&ring->flush_request, 1, __ATOMIC_SEQ_CST) ;
+    if(__atomic_load_n(&ring->writer_waiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ring->wait_lock) ;
+        pthread_cond_signal(&ring->data_cond) ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+    }
+}
+
+static void file_ring_write_all(struct file_ring *ring, 
+                                struct iovec *iov, int iovcnt)
+{
+    while(iovcnt>0)
+    {
+        ssize_t n=writev(ring->fd, iov, iovcnt) ;
+        if(n<0)
+        {
+            if(errno==EINTR) continue ;
+            // Write error. Count rest of the data as dropped.
+            for( ; iovcnt>0 ; iov++, iovcnt--)
+            {
+                __atomic_fetch_add(&ring->dropped, iov->iov_len, 
+                                   __ATOMIC_RELAXED) ;
+            }
+            return ;
+        }
+        while(iovcnt>0 && (size_t)n>=iov->iov_len)
+        {
+            n-=iov->iov_len ;
+            iov++ ;
+            iovcnt-- ;
+        }
+        if(iovcnt>0)
+        {
+            iov->iov_base=(char *)iov->iov_base+n ;
+            iov->iov_len-=n ;
+        }
+    }
+}
+
+static struct file_compressor *file_compressor_create(
+    enum file_compression type, int level, int block_size)
+{
+    struct file_compressor *c=calloc(1, sizeof(struct file_compressor)) ;
+    if(c==NULL) return NULL ;
+    c->type=type ;
+    c->level=level ;
+    c->block_size= block_size>0 ? block_size : 1024*1024 ;
+    c->in=malloc(c->block_size) ;
+    switch(type)
+    {
+#ifdef HAVE_ZLIB
+        case compress_gzip:
+            if(deflateInit2(&c->z, level<0 ? Z_DEFAULT_COMPRESSION : level,
+                            Z_DEFLATED, 15+16, 8, 
+                            Z_DEFAULT_STRATEGY)!=Z_OK) 
+            {
+                free(c->in) ;
+                c->in=NULL ;
+                break ;
+            }
+            c->out_size=deflateBound(&c->z, c->block_size) ;
+            break ;
+#endif
+#ifdef HAVE_ZSTD
+        case compress_zstd:
+            c->zstd= level<=ZSTD_maxCLevel() ? ZSTD_createCCtx() : NULL ;
+            if(c->zstd==NULL)
+            {
+                free(c->in) ;
+                c->in=NULL ;
+                break ;
+            }
+            c->out_size=ZSTD_compressBound(c->block_size) ;
+            break ;
+#endif
+        default:
+            free(c->in) ;
+            c->in=NULL ;
+            break ;
+    }
+    if(c->in!=NULL) c->out=malloc(c->out_size) ;
+    if(c->in==NULL || c->out==NULL)
+    {
+        printf("Could not start file compression!\r\n") ;
+        free(c->in) ;
+        free(c) ;
+        return NULL ;
+    }
+    return c ;
+}
+
+static void file_compressor_free(struct file_compressor *c)
+{
+    if(c==NULL) return ;
+#ifdef HAVE_ZLIB
+    if(c->type==compress_gzip) deflateEnd(&c->z) ;
+#endif
+#ifdef HAVE_ZSTD
+    if(c->type==compress_zstd) ZSTD_freeCCtx(c->zstd) ;
+#endif
+    free(c->in) ;
+    free(c->out) ;
+    free(c) ;
+}
+
+// Publish written position and wake threads waiting for it.
+static void file_ring_set_written(struct file_ring *ring, uint64_t pos)
+{
+    __atomic_store_n(&ring->written, pos, __ATOMIC_SEQ_CST) ;
+    if(__atomic_load_n(&ring->written_waiters, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ring->wait_lock) ;
+        pthread_cond_broadcast(&ring->written_cond) ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+    }
+}
+
+// Compress and write collected block.
+static void file_compress_block(struct file_ring *ring)
+{
+    struct file_compressor *c=ring->compressor ;
+    struct iovec iov ;
+    size_t len=0 ;
+    if(c->in_len==0) 
+    {
+        file_ring_set_written(ring, ring->drained) ;
+        return ;
+    }
+    switch(c->type)
+    {
+#ifdef HAVE_ZLIB
+        case compress_gzip:
+            c->z.next_in=(Bytef *)c->in ;
+            c->z.avail_in=c->in_len ;
+            c->z.next_out=(Bytef *)c->out ;
+            c->z.avail_out=c->out_size ;
+            deflate(&c->z, Z_FINISH) ;
+            len=c->out_size-c->z.avail_out ;
+            deflateReset(&c->z) ;
+            break ;
+#endif
+#ifdef HAVE_ZSTD
+        case compress_zstd:
+            len=ZSTD_compressCCtx(c->zstd, c->out, c->out_size, 
+                                  c->in, c->in_len, 
+                                  c->level<0 ? ZSTD_CLEVEL_DEFAULT 
+                                             : c->level) ;
+            if(ZSTD_isError(len)) len=0 ;
+            break ;
+#endif
+        default:
+            break ;
+    }
+    __atomic_fetch_add(&c->bytes_in, c->in_len, __ATOMIC_RELAXED) ;
+    __atomic_fetch_add(&c->bytes_out, len, __ATOMIC_RELAXED) ;
+    c->in_len=0 ;
+    iov.iov_base=c->out ;
+    iov.iov_len=len ;
+    file_ring_write_all(ring, &iov, 1) ;
+    file_ring_set_written(ring, ring->drained) ;
+}
+
+// Write drained data to file, or to compression blocks.
+static void file_ring_output(struct file_ring *ring, 
+                             struct iovec *iov, int iovcnt)
+{
+    struct file_compressor *c=ring->compressor ;
+    int i ;
+    if(c==NULL) 
+    {
+        file_ring_write_all(ring, iov, iovcnt) ;
+        return ;
+    }
+    for(i=0 ; i<iovcnt ; i++)
+    {
+        const char *data=iov[i].iov_base ;
+        size_t len=iov[i].iov_len ;
+        while(len>0)
+        {
+            size_t n=c->block_size-c->in_len ;
+            if(n>len) n=len ;
+            memcpy(c->in+c->in_len, data, n) ;
+            c->in_len+=n ;
+            data+=n ;
+            len-=n ;
+            if(c->in_len==c->block_size) file_compress_block(ring) ;
+        }
+    }
+}
+
+static void file_retired_close(struct file_retired *retired)
+{
+    if(retired->sync)
+    {
+        fflush(retired->f) ;
+        fdatasync(fileno(retired->f)) ;
+    }
+    fclose(retired->f) ;
+    free(retired->buffer) ;
+}
+
+// Continue writing to next file of rotation. Closes the previous file.
+// Returns the following switch or NULL.
+static struct file_switch *file_ring_switch(struct file_ring *ring)
+{
+    struct file_switch *sw, *next ;
+    if(ring->compressor!=NULL) file_compress_block(ring) ;
+    pthread_mutex_lock(&ring->wait_lock) ;
+    sw=ring->switches ;
+    next=ring->switches=sw->next ;
+    __atomic_fetch_sub(&ring->switch_pending, 1, __ATOMIC_RELEASE) ;
+    pthread_mutex_unlock(&ring->wait_lock) ;
+    ring->fd=sw->fd ;
+    file_retired_close(&sw->retired) ;
+    free(sw) ;
+    return next ;
+}
+
+// Write queued data between tail and head. Returns number of bytes drained.
+static uint64_t file_ring_drain(struct file_ring *ring)
+{
+    uint64_t tail=__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ;
+    uint64_t head=__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ;
+    uint64_t len, start ;
+    struct iovec iov[2] ;
+    int iovcnt ;
+    if(__atomic_load_n(&ring->switch_pending, __ATOMIC_ACQUIRE))
+    {
+        struct file_switch *sw ;
+        pthread_mutex_lock(&ring->wait_lock) ;
+        sw=ring->switches ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+        // Data before pos goes to the previous file
+        while(sw!=NULL && tail>=sw->pos) sw=file_ring_switch(ring) ;
+        if(sw!=NULL && head>sw->pos) head=sw->pos ;
+    }
+    len=head-tail ;
+    start=tail%ring->size ;
+    if(len==0) return 0 ;
+
+    if(ring->overflow==overflow_drop_oldest)
+    {
+        // Copy data out. Producers may drop the copied data meanwhile.
+        uint64_t skip=0, valid ;
+        if(len>FILE_RING_CHUNK) len=FILE_RING_CHUNK ;
+        uint64_t first=ring->size-start ;
+        if(first>len) first=len ;
+        memcpy(ring->chunk, ring->data+start, first) ;
+        memcpy(ring->chunk+first, ring->data, len-first) ;
+        valid=tail ;
+        while(!__atomic_compare_exchange_n(&ring->tail, &valid, tail+len, 0,
+                                           __ATOMIC_ACQ_REL, 
+                                           __ATOMIC_ACQUIRE))
+        {
+            if(valid>=tail+len) return len ; // All dropped
+        }
+        skip=valid-tail ;
+        iov[0].iov_base=ring->chunk+skip ;
+        iov[0].iov_len=len-skip ;
+        iovcnt=1 ;
+    }
+    else
+    {
+        iov[0].iov_base=ring->data+start ;
+        iov[0].iov_len=len ;
+        iovcnt=1 ;
+        if(start+len>ring->size)
+        {
+            iov[0].iov_len=ring->size-start ;
+            iov[1].iov_base=ring->data ;
+            iov[1].iov_len=len-iov[0].iov_len ;
+            iovcnt=2 ;
+        }
+    }
+    file_ring_output(ring, iov, iovcnt) ;
+    ring->drained=tail+len ;
+    if(ring->compressor==NULL) 
+    {
+        file_ring_set_written(ring, tail+len) ;
+    }
+    if(ring->overflow!=overflow_drop_oldest)
+    {
+        __atomic_store_n(&ring->tail, tail+len, __ATOMIC_SEQ_CST) ;
+    }
+
+    if(__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ring->wait_lock) ;
+        pthread_cond_broadcast(&ring->space_cond) ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+    }
+    return len ;
+}
+
+// Writer thread of asynchronous file channel
+static void *file_ring_writer(void *data)
+{
+    struct file_data *this=data ;
+    struct file_ring *ring=this->ring ;
+    int flush=0 ; // Flush requested after the last compressed block
+    for(;;)
+    {
+        if(file_ring_drain(ring)>0) continue ;
+        if(ring->compressor!=NULL && (flush || ring->stop))
+        {
+            // Queue is empty: complete block of flushed data
+            file_compress_block(ring) ;
+            flush=0 ;
+        }
+
+        pthread_mutex_lock(&ring->wait_lock) ;
+        __atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST) ;
+        if(__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)
+           ==__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST))
+        {
+            if(ring->stop) 
+            {
+                pthread_mutex_unlock(&ring->wait_lock) ;
+                if(ring->compressor!=NULL) file_compress_block(ring) ;
+                break ;
+            }
+            if(__atomic_exchange_n(&ring->flush_request, 0, 
+                                   __ATOMIC_SEQ_CST) 
+               && ring->compressor!=NULL && ring->compressor->in_len>0)
+            {
+                // Complete the block before sleeping
+                flush=1 ;
+                __atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&ring->wait_lock) ;
+                continue ;
+            }
+            pthread_cond_wait(&ring->data_cond, &ring->wait_lock) ;
+        }
+        else if(!__atomic_load_n(&ring->flush_request, __ATOMIC_SEQ_CST)
+                && !ring->stop && this->flush_policy!=flush_write
+                && !__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST))
+        {
+            // Collect more data until kicked according to flush policy
+            // or until producer waits for space
+            pthread_cond_wait(&ring->data_cond, &ring->wait_lock) ;
+        }
+        __atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST) ;
+        if(__atomic_exchange_n(&ring->flush_request, 0, __ATOMIC_SEQ_CST))
+        {
+            flush=1 ;
+        }
+        pthread_mutex_unlock(&ring->wait_lock) ;
+    }
+    return NULL ;
+}
+
+// Start asynchronous writer for opened file. Call with lock held.
+// Returns -1 when compression is requested but could not be started.
+static int file_async_start(struct file_data *this)
+{
+    struct file_ring *ring ;
+    int block= this->compress_block>0 ? this->compress_block : 1024*1024 ;
+    int compress= this->compression!=compress_none ;
+    if((this->async_size<=0 && !compress) 
+       || this->f==NULL || this->ring!=NULL) return 0 ;
+    fflush(this->f) ;
+    ring=calloc(1, sizeof(struct file_ring)) ;
+    if(ring==NULL) return compress ? -1 : 0 ;
+    // Compression needs the writer thread. Queue defaults to two blocks,
+    // so a block can be filled while the previous one is compressed.
+    ring->size= this->async_size>0 ? (uint64_t)this->async_size 
+                                    : 2*(uint64_t)block ;
+    ring->data=malloc(ring->size) ;
+    ring->overflow=this->overflow ;
+    if(ring->overflow==overflow_drop_oldest)
+    {
+        ring->chunk=malloc(FILE_RING_CHUNK) ;
+    }
+    if(ring->data==NULL || 
+       (ring->overflow==overflow_drop_oldest && ring->chunk==NULL))
+    {
+        printf("Could not allocate write queue!\r\n") ;
+        free(ring->data) ;
+        free(ring->chunk) ;
+        free(ring) ;
+        return compress ? -1 : 0 ;
+    }
+    if(compress)
+    {
+        ring->compressor=file_compressor_create(this->compression, 
+                                                this->compress_level, 
+                                                this->compress_block) ;
+        if(ring->compressor==NULL)
+        {
+            free(ring->data) ;
+            free(ring->chunk) ;
+            free(ring) ;
+            return -1 ;
+        }
+    }
+    ring->fd=fileno(this->f) ;
+    pthread_mutex_init(&ring->wait_lock, NULL) ;
+    pthread_cond_init(&ring->data_cond, NULL) ;
+    pthread_cond_init(&ring->space_cond, NULL) ;
+    pthread_cond_init(&ring->written_cond, NULL) ;
+    this->ring=ring ;
+    if(pthread_create(&ring->thread, NULL, file_ring_writer, this)!=0)
+    {
+        printf("Could not start file writer thread!\r\n") ;
+        this->ring=NULL ;
+        pthread_cond_destroy(&ring->data_cond) ;
+        pthread_cond_destroy(&ring->space_cond) ;
+        pthread_cond_destroy(&ring->written_cond) ;
+        pthread_mutex_destroy(&ring->wait_lock) ;
+        file_compressor_free(ring->compressor) ;
+        free(ring->data) ;
+        free(ring->chunk) ;
+        free(ring) ;
+        return compress ? -1 : 0 ;
+    }
+    return 0 ;
+}
+
+// Write all queued data and stop asynchronous writer. Call with lock held.
+static void file_async_stop(struct file_data *this)
+{
+    struct file_ring *ring=this->ring ;
+    if(ring==NULL) return ;
+    pthread_mutex_lock(&ring->wait_lock) ;
+    ring->stop=1 ;
+    pthread_cond_signal(&ring->data_cond) ;
+    pthread_mutex_unlock(&ring->wait_lock) ;
+    pthread_join(ring->thread, NULL) ;
+    // Release threads waiting for written data and wait until they are out
+    pthread_mutex_lock(&ring->wait_lock) ;
+    ring->exited=1 ;
+    pthread_cond_broadcast(&ring->written_cond) ;
+    while(ring->written_waiters>0)
+    {
+        pthread_cond_wait(&ring->written_cond, &ring->wait_lock) ;
+    }
+    pthread_mutex_unlock(&ring->wait_lock) ;
+    while(ring->switches!=NULL) file_ring_switch(ring) ;
+    this->ring=NULL ;
+    pthread_cond_destroy(&ring->data_cond) ;
+    pthread_cond_destroy(&ring->space_cond) ;
+    pthread_cond_destroy(&ring->written_cond) ;
+    pthread_mutex_destroy(&ring->wait_lock) ;
+    file_compressor_free(ring->compressor) ;
+    free(ring->data) ;
+    free(ring->chunk) ;
+    free(ring) ;
+}
+
+// Queue data to asynchronous writer. Call with lock held.
+static void file_async_write(struct file_data *this, 
+                             const char *data, uint64_t len)
+{
+    struct file_ring *ring=this->ring ;
+    uint64_t head=ring->head ; // Only modified under file lock
+    uint64_t tail, depth, start, first ;
+
+    if(len>ring->size)
+    {
+        if(ring->overflow==overflow_block)
+        {
+            // Queue piecewise
+            while(len>0)
+            {
+                uint64_t n=len<ring->size ? len : ring->size ;
+                file_async_write(this, data, n) ;
+                data+=n ;
+                len-=n ;
+            }
+            return ;
+        }
+        else if(ring->overflow==overflow_drop_oldest)
+        {
+            // Keep the newest data that fits
+            __atomic_fetch_add(&ring->dropped, len-ring->size, 
+                               __ATOMIC_RELAXED) ;
+            data+=len-ring->size ;
+            len=ring->size ;
+        }
+        else 
+        {
+            __atomic_fetch_add(&ring->dropped, len, __ATOMIC_RELAXED) ;
+            return ;
+        }
+    }
+
+    for(;;)
+    {
+        tail=__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ;
+        if(ring->size-(head-tail)>=len) break ;
+        if(ring->overflow==overflow_drop_newest)
+        {
+            __atomic_fetch_add(&ring->dropped, len, __ATOMIC_RELAXED) ;
+            return ;
+        }
+        else if(ring->overflow==overflow_drop_oldest)
+        {
+            uint64_t drop=len-(ring->size-(head-tail)) ;
+            if(__atomic_compare_exchange_n(&ring->tail, &tail, tail+drop, 0,
+                                           __ATOMIC_ACQ_REL, 
+                                           __ATOMIC_ACQUIRE))
+            {
+                __atomic_fetch_add(&ring->dropped, drop, __ATOMIC_RELAXED) ;
+            }
+        }
+        else // Block until writer thread makes space
+        {
+            pthread_mutex_lock(&ring->wait_lock) ;
+            __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST) ;
+            if(ring->size-(head-__atomic_load_n(&ring->tail, 
+                                                __ATOMIC_SEQ_CST))<len)
+            {
+                pthread_cond_signal(&ring->data_cond) ;
+                pthread_cond_wait(&ring->space_cond, &ring->wait_lock) ;
+            }
+            __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST) ;
+            pthread_mutex_unlock(&ring->wait_lock) ;
+        }
+    }
+
+    start=head%ring->size ;
+    first=ring->size-start ;
+    if(first>len) first=len ;
+    memcpy(ring->data+start, data, first) ;
+    memcpy(ring->data, data+first, len-first) ;
+    __atomic_store_n(&ring->head, head+len, __ATOMIC_SEQ_CST) ;
+
+    depth=head+len-tail ;
+    if(depth>__atomic_load_n(&ring->high_water, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&ring->high_water, depth, __ATOMIC_RELAXED) ;
+    }
+
+    if(this->flush_policy==flush_write 
+       || (this->flush_policy==flush_bytes 
+           && depth>=(uint64_t)this->flush_limit))
+    {
+        file_ring_kick(ring, 0) ;
+    }
+}
+
+// Have the writer thread write data queued until now to file, including
+// incomplete compressed block, and wait until it is written. Call with 
+// file lock held. The lock is released while waiting, so this->ring may 
+// change.
+static void file_ring_wait_written(struct file_data *this)
+{
+    struct file_ring *ring=this->ring ;
+    uint64_t head=ring->head ; // Only modified under file lock
+    file_ring_kick(ring, 1) ;
+    pthread_mutex_lock(&ring->wait_lock) ;
+    __atomic_add_fetch(&ring->written_waiters, 1, __ATOMIC_SEQ_CST) ;
+    if(__atomic_load_n(&ring->written, __ATOMIC_SEQ_CST)<head)
+    {
+        // Ring is kept until waiters are out, see file_async_stop
+        pthread_mutex_unlock(&this->lock) ;
+        while(!ring->exited && 
+              __atomic_load_n(&ring->written, __ATOMIC_SEQ_CST)<head)
+        {
+            pthread_cond_wait(&ring->written_cond, &ring->wait_lock) ;
+        }
+        __atomic_sub_fetch(&ring->written_waiters, 1, __ATOMIC_SEQ_CST) ;
+        if(ring->exited) pthread_cond_broadcast(&ring->written_cond) ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+        pthread_mutex_lock(&this->lock) ;
+        return ;
+    }
+    __atomic_sub_fetch(&ring->written_waiters, 1, __ATOMIC_SEQ_CST) ;
+    pthread_mutex_unlock(&ring->wait_lock) ;
+}
+
+static void file_flush_timer(struct dispatch_source *source)
+{
+    struct file_data *this=(struct file_data *)
+        ((char *)source - offsetof(struct file_data, flush_timer)) ;
+    if(dispatch_expirations(source)==0) return ;
+    // The dispatcher must not wait for a writer that may be blocked on a
+    // full queue or slow disk. The writer flushes when it is done.
+    if(pthread_mutex_trylock(&this->lock)!=0)
+    {
+        __atomic_store_n(&this->flush_pending, 1, __ATOMIC_SEQ_CST) ;
+        return ;
+    }
+    __atomic_store_n(&this->flush_pending, 0, __ATOMIC_SEQ_CST) ;
+    if(this->ring!=NULL)
+    {
+        file_ring_kick(this->ring, 1) ;
+    }
+    else if(this->f!=NULL && this->unflushed>0) 
+    {
+        fflush(this->f) ;
+        this->unflushed=0 ;
+    }
+    pthread_mutex_unlock(&this->lock) ;
+}
+
+// Set flush policy of file channel
+static void file_set_flush(struct file_data *this, 
+                           enum file_flush_policy policy, long limit)
+{
+    struct itimerspec its={{0,0},{0,0}} ;
+    this->flush_policy=policy ;
+    this->flush_limit=limit ;
+    if(policy==flush_time && limit>0)
+    {
+        if(this->flush_timer.fd<0)
+        {
+            this->flush_timer.handler=file_flush_timer ;
+            this->flush_timer.fd=timerfd_create(CLOCK_MONOTONIC, 
+                                                TFD_NONBLOCK | TFD_CLOEXEC) ;
+            if(this->flush_timer.fd<0 || dispatch_add(&this->flush_timer)!=0)
+            {
+                printf("Failed to setup flush timer\r\n") ;
+                return ;
+            }
+        }
+        its.it_interval.tv_sec=limit/1000 ;
+        its.it_interval.tv_nsec=(limit%1000)*1000000 ;
+        its.it_value=its.it_interval ;
+    }
+    if(this->flush_timer.fd>=0) 
+    {
+        timerfd_settime(this->flush_timer.fd, 0, &its, 0) ;
+    }
+}
+
+// Create directories of file path if they dont exist
+static void file_make_dirs(const char *filename)
+{
+    int namelen=strlen(filename) ;
+    char dirname[namelen+1] ;
+    int i ;
+    strcpy(dirname, filename) ;
+    for (i=0 ; i<namelen ; i++ )
+    {
+        if(dirname[i]=='\\' || dirname[i]=='/') 
+        {
+            char c=dirname[i] ;
+            dirname[i]=0 ;
+            mkdir(dirname, 0777);
+            dirname[i]=c ;
+        }
+    }
+}
+
+// Opened file waiting to become the current file of rotation
+struct file_successor
+{
+    FILE *f ;
+    char *buffer ; // stdio buffer
+    char *filename ;
+    char *base ; // Filename without sequence suffix
+    int sequence ;
+    time_t from ; // Start of period the file is for
+    uint64_t size ; // Bytes in file when opened (append mode)
+    int unused ; // Name is not used by any file of the channel
+} ;
+
+// Rotation of file to new files named by strftime pattern. Successors 
+// are opened by the rotator thread before they are needed, so rotation
+// in the writing thread only exchanges pointers.
+struct file_rotation
+{
+    struct time_format format ; // Filename pattern
+    char mode[5] ;
+    long period ; // Rotate on multiples of period seconds, 0=no
+    uint64_t max_bytes ; // Rotate when file has max_bytes, 0=no
+    int buffer_size ;
+    // Current file. Modified under file lock and lock.
+    uint64_t written ; // Bytes written to current file
+    time_t rotate_at ; // Next time of time rotation
+    char *base ; 
+    int sequence ;
+    unsigned int generation ; // Incremented on rotation
+    uint64_t rotations ;
+    uint64_t sync_opens ; // Rotations without prepared successor
+    // Rotator thread:
+    struct file_successor time_next ; // For next rotation time
+    struct file_successor size_next ; // For rotation on size
+    struct file_successor stale ; // Unused successor to close
+    struct file_retired *retired ; // Previous files to close
+    pthread_t thread ;
+    pthread_mutex_t lock ;
+    pthread_cond_t cond ;
+    pthread_cond_t retired_cond ; // Signaled when retired file is closed
+    int retired_waiters ; // Threads waiting on retired_cond
+    int stop ;
+} ;
+
+// Next multiple of period after time t in local time
+static time_t file_rotation_boundary(struct file_rotation *rot, time_t t)
+{
+    long offset=current_tz_offset(t, timezone_offset) ;
+    return ((t+offset)/rot->period+1)*rot->period-offset ;
+}
+
+// Name and open successor starting at time from. Sequence suffix is added
+// when the name equals base. Returns 0 on success.
+static int file_successor_open(struct file_rotation *rot, 
+                               struct file_successor *next, time_t from,
+                               const char *base, int sequence)
+{
+    char name[TIME_FORMAT_LEN] ;
+    struct timespec ts={from, 0} ;
+    struct stat st ;
+    int len=time_format_print(&rot->format, name, sizeof(name), &ts, 
+                              timezone_offset) ;
+    memset(next, 0, sizeof(struct file_successor)) ;
+    next->from=from ;
+    next->base=strdup(name) ;
+    if(base!=NULL && strcmp(name, base)==0) next->sequence=sequence+1 ;
+    if(next->sequence>0 && len<(int)sizeof(name)-12)
+    {
+        snprintf(name+len, sizeof(name)-len, ".%d", next->sequence) ;
+    }
+    next->filename=strdup(name) ;
+    file_make_dirs(name) ;
+    next->f=fopen(name, rot->mode) ;
+    if(next->f==NULL || next->base==NULL || next->filename==NULL)
+    {
+        printf("Could not open file %s\r\n", name) ;
+        if(next->f!=NULL) fclose(next->f) ;
+        free(next->base) ;
+        free(next->filename) ;
+        memset(next, 0, sizeof(struct file_successor)) ;
+        return -1 ;
+    }
+    if(fstat(fileno(next->f), &st)==0) next->size=st.st_size ;
+    if(rot->buffer_size>0)
+    {
+        next->buffer=malloc(rot->buffer_size) ;
+        if(next->buffer!=NULL)
+        {
+            setvbuf(next->f, next->buffer, _IOFBF, rot->buffer_size) ;
+        }
+    }
+    return 0 ;
+}
+
+// Close successor that was not used. Removes the file if it is empty and
+// the name is known to be unused. Successor opened while the channel 
+// rotated may have the name of a file whose data is still queued.
+static void file_successor_discard(struct file_successor *next)
+{
+    if(next->f!=NULL)
+    {
+        long size ;
+        fseek(next->f, 0, SEEK_END) ;
+        size=ftell(next->f) ;
+        fclose(next->f) ;
+        if(size==0 && next->unused) unlink(next->filename) ;
+    }
+    free(next->buffer) ;
+    free(next->filename) ;
+    free(next->base) ;
+    memset(next, 0, sizeof(struct file_successor)) ;
+}
+
+static void *file_rotator(void *data)
+{
+    struct file_rotation *rot=data ;
+    pthread_mutex_lock(&rot->lock) ;
+    while(!rot->stop)
+    {
+        struct file_successor next, *slot=NULL ;
+        unsigned int generation=rot->generation ;
+        char *base ;
+        int sequence=rot->sequence ;
+        time_t from=0 ;
+        if(rot->retired!=NULL)
+        {
+            struct file_retired *retired=rot->retired ;
+            pthread_mutex_unlock(&rot->lock) ;
+            file_retired_close(retired) ;
+            pthread_mutex_lock(&rot->lock) ;
+            rot->retired=retired->next ; // Listed until closed
+            free(retired) ;
+            pthread_cond_broadcast(&rot->retired_cond) ;
+            continue ;
+        }
+        if(rot->stale.filename!=NULL)
+        {
+            next=rot->stale ;
+            memset(&rot->stale, 0, sizeof(struct file_successor)) ;
+            pthread_mutex_unlock(&rot->lock) ;
+            file_successor_discard(&next) ;
+            pthread_mutex_lock(&rot->lock) ;
+            continue ;
+        }
+        if(rot->period>0 && rot->time_next.f==NULL)
+        {
+            slot=&rot->time_next ;
+            from=rot->rotate_at ;
+        }
+        else if(rot->max_bytes>0 && rot->size_next.f==NULL)
+        {
+            slot=&rot->size_next ;
+            from= rot->period>0 ? rot->rotate_at-rot->period : time(NULL) ;
+        }
+        if(slot==NULL) 
+        {
+            pthread_cond_wait(&rot->cond, &rot->lock) ;
+            continue ;
+        }
+        base= rot->base!=NULL ? strdup(rot->base) : NULL ;
+        pthread_mutex_unlock(&rot->lock) ;
+        if(file_successor_open(rot, &next, from, base, sequence)!=0)
+        {
+            // Try again on next rotation
+            free(base) ;
+            pthread_mutex_lock(&rot->lock) ;
+            pthread_cond_wait(&rot->cond, &rot->lock) ;
+            continue ;
+        }
+        free(base) ;
+        pthread_mutex_lock(&rot->lock) ;
+        if(generation!=rot->generation || slot->f!=NULL) 
+        {
+            // Rotated meanwhile
+            pthread_mutex_unlock(&rot->lock) ;
+            file_successor_discard(&next) ;
+            pthread_mutex_lock(&rot->lock) ;
+        }
+        else *slot=next ;
+    }
+    pthread_mutex_unlock(&rot->lock) ;
+    return NULL ;
+}
+
+// Change to next file. Call with file lock held.
+static void file_rotate(struct file_data *this, time_t now, int by_time)
+{
+    struct file_rotation *rot=this->rotation ;
+    struct file_successor next, discard, *slot ;
+    time_t from= rot->period>0 ? file_rotation_boundary(rot, now)-rot->period
+                               : now ;
+    struct file_switch *sw=NULL ;
+    struct file_retired *retired=NULL ;
+
+    // Previous file is queued to writer thread or to rotator for closing
+    if(this->ring!=NULL) sw=malloc(sizeof(struct file_switch)) ;
+    else retired=malloc(sizeof(struct file_retired)) ;
+    if(sw==NULL && retired==NULL)
+    {
+        pthread_mutex_lock(&rot->lock) ;
+        if(rot->period>0) rot->rotate_at=now+1 ; // Retry
+        pthread_mutex_unlock(&rot->lock) ;
+        return ;
+    }
+    if(sw!=NULL) retired=&sw->retired ;
+    retired->f=this->f ;
+    retired->buffer=this->buffer ;
+    retired->sync= this->sync!=NULL ;
+    retired->next=NULL ;
+    memset(&next, 0, sizeof(next)) ;
+    memset(&discard, 0, sizeof(discard)) ;
+    pthread_mutex_lock(&rot->lock) ;
+    slot= by_time ? &rot->time_next : &rot->size_next ;
+    if(slot->f!=NULL && (rot->period==0 || slot->from==from)) 
+    {
+        next=*slot ;
+        memset(slot, 0, sizeof(struct file_successor)) ;
+    }
+    pthread_mutex_unlock(&rot->lock) ;
+    if(next.f==NULL)
+    {
+        // Not prepared. Open in this thread.
+        rot->sync_opens++ ;
+        if(file_successor_open(rot, &next, from, rot->base, 
+                               rot->sequence)!=0)
+        {
+            pthread_mutex_lock(&rot->lock) ;
+            if(rot->period>0) rot->rotate_at=now+1 ; // Retry
+            pthread_mutex_unlock(&rot->lock) ;
+            rot->written=0 ;
+            if(sw!=NULL) free(sw) ;
+            else free(retired) ;
+            return ;
+        }
+    }
+
+    // Swap to new file
+    if(sw!=NULL)
+    {
+        struct file_ring *ring=this->ring ;
+        struct file_switch **last ;
+        fflush(next.f) ;
+        sw->fd=fileno(next.f) ;
+        sw->pos=ring->head ;
+        sw->next=NULL ;
+        pthread_mutex_lock(&ring->wait_lock) ;
+        for(last=&ring->switches ; *last!=NULL ; last=&(*last)->next) ;
+        *last=sw ;
+        __atomic_fetch_add(&ring->switch_pending, 1, __ATOMIC_RELEASE) ;
+        pthread_mutex_unlock(&ring->wait_lock) ;
+        file_ring_kick(ring, 0) ;
+    }
+    this->f=next.f ;
+    this->buffer=next.buffer ;
+    free(this->filename) ;
+    this->filename=next.filename ;
+    this->unflushed=0 ;
+
+    pthread_mutex_lock(&rot->lock) ;
+    if(sw==NULL)
+    {
+        // Appended after the head that the rotator is closing
+        struct file_retired **last ;
+        for(last=&rot->retired ; *last!=NULL ; last=&(*last)->next) ;
+        *last=retired ;
+    }
+    // Other successor was named for the previous file
+    slot= by_time ? &rot->size_next : &rot->time_next ;
+    // Size successor of the previous period is left unused, unless it 
+    // has the same name as the new file (pattern without time).
+    slot->unused= by_time && slot->filename!=NULL 
+                  && strcmp(slot->filename, next.filename)!=0 ;
+    if(rot->stale.f==NULL) 
+    {
+        rot->stale=*slot ;
+        memset(slot, 0, sizeof(struct file_successor)) ;
+    }
+    else 
+    {
+        discard=*slot ; 
+        memset(slot, 0, sizeof(struct file_successor)) ;
+    }
+    free(rot->base) ;
+    rot->base=next.base ;
+    rot->sequence=next.sequence ;
+    rot->generation++ ;
+    rot->rotations++ ;
+    rot->written=next.size ;
+    if(rot->period>0) rot->rotate_at=file_rotation_boundary(rot, now) ;
+    pthread_cond_signal(&rot->cond) ;
+    pthread_mutex_unlock(&rot->lock) ;
+    file_successor_discard(&discard) ;
+}
+
+// Rotate file if the time or size limit is reached by writing len bytes.
+// Call with file lock held.
+static inline void file_rotate_check(struct file_data *this, int len)
+{
+    struct file_rotation *rot=this->rotation ;
+    if(rot->period>0)
+    {
+        time_t now=time(NULL) ;
+        if(now>=rot->rotate_at) file_rotate(this, now, 1) ;
+    }
+    while(rot->max_bytes>0 && rot->written>0 
+          && rot->written+len>rot->max_bytes) 
+    {
+        // Next file may also be full when appending to existing files
+        uint64_t rotations=rot->rotations ;
+        file_rotate(this, time(NULL), 0) ;
+        if(rot->rotations==rotations) break ;
+    }
+    rot->written+=len ;
+}
+
+// Stop rotation. Call with file lock held before closing current file.
+static void file_rotation_stop(struct file_data *this)
+{
+    struct file_rotation *rot=this->rotation ;
+    if(rot==NULL) return ;
+    pthread_mutex_lock(&rot->lock) ;
+    rot->stop=1 ;
+    pthread_cond_signal(&rot->cond) ;
+    pthread_mutex_unlock(&rot->lock) ;
+    pthread_join(rot->thread, NULL) ;
+    while(rot->retired!=NULL) 
+    {
+        struct file_retired *retired=rot->retired ;
+        rot->retired=retired->next ;
+        file_retired_close(retired) ;
+        free(retired) ;
+    }
+    // Release threads waiting for retired files and wait until they are out
+    pthread_mutex_lock(&rot->lock) ;
+    pthread_cond_broadcast(&rot->retired_cond) ;
+    while(rot->retired_waiters>0) 
+    {
+        pthread_cond_wait(&rot->retired_cond, &rot->lock) ;
+    }
+    pthread_mutex_unlock(&rot->lock) ;
+    // Prepared successors were named after the current file
+    if(rot->time_next.filename!=NULL && this->filename!=NULL)
+    {
+        rot->time_next.unused=strcmp(rot->time_next.filename, 
+                                     this->filename)!=0 ;
+    }
+    if(rot->size_next.filename!=NULL && this->filename!=NULL)
+    {
+        rot->size_next.unused=strcmp(rot->size_next.filename, 
+                                     this->filename)!=0 ;
+    }
+    file_successor_discard(&rot->time_next) ;
+    file_successor_discard(&rot->size_next) ;
+    file_successor_discard(&rot->stale) ;
+    pthread_mutex_destroy(&rot->lock) ;
+    pthread_cond_destroy(&rot->cond) ;
+    pthread_cond_destroy(&rot->retired_cond) ;
+    free(rot->base) ;
+    free(rot) ;
+    this->rotation=NULL ;
+}
+
+// Wait for rotator to sync and close previous files. Call with file lock
+// held. The lock is released while waiting, so this->rotation may change.
+static void file_rotation_wait_retired(struct file_data *this)
+{
+    struct file_rotation *rot=this->rotation ;
+    pthread_mutex_lock(&rot->lock) ;
+    if(rot->retired!=NULL)
+    {
+        // Rotation is kept until waiters are out, see file_rotation_stop
+        rot->retired_waiters++ ;
+        pthread_mutex_unlock(&this->lock) ;
+        while(rot->retired!=NULL) 
+        {
+            pthread_cond_wait(&rot->retired_cond, &rot->lock) ;
+        }
+        rot->retired_waiters-- ;
+        if(rot->stop) pthread_cond_broadcast(&rot->retired_cond) ;
+        pthread_mutex_unlock(&rot->lock) ;
+        pthread_mutex_lock(&this->lock) ;
+        return ;
+    }
+    pthread_mutex_unlock(&rot->lock) ;
+}
+
+// Group commit: background thread commits all written data to disk with
+// one fdatasync every interval_ms, or when bytes_limit bytes are pending.
+// Offsets are counted in bytes written to the channel.
+struct file_sync
+{
+    long interval_ms ; // 0=only on bytes_limit
+    uint64_t bytes_limit ; // 0=only on interval
+    uint64_t accepted ; // Bytes written to channel. Under file lock.
+    uint64_t requested ; // accepted at last bytes_limit request
+    // Statistics:
+    uint64_t synced ; // Bytes committed to disk
+    uint64_t syncs ;
+    uint64_t last_ns ; // Latency of last fdatasync
+    uint64_t max_ns ;
+    uint64_t total_ns ;
+    struct timespec last_time ; // Completion of last sync (monotonic)
+    pthread_t thread ;
+    pthread_mutex_t lock ;
+    pthread_cond_t cond ;
+    int kicked ;
+    int stop ;
+} ;
+
+static void *file_syncer(void *data)
+{
+    struct file_data *this=data ;
+    struct file_sync *sync=this->sync ;
+    pthread_mutex_lock(&sync->lock) ;
+    while(!sync->stop)
+    {
+        struct timespec start, end ;
+        uint64_t offset, ns ;
+        int fd=-1 ;
+        if(!sync->kicked)
+        {
+            if(sync->interval_ms>0)
+            {
+                struct timespec ts ;
+                clock_gettime(CLOCK_REALTIME, &ts) ;
+                ts.tv_sec+=sync->interval_ms/1000 ;
+                ts.tv_nsec+=(sync->interval_ms%1000)*1000000L ;
+                if(ts.tv_nsec>=1000000000L)
+                {
+                    ts.tv_sec++ ;
+                    ts.tv_nsec-=1000000000L ;
+                }
+                pthread_cond_timedwait(&sync->cond, &sync->lock, &ts) ;
+            }
+            else pthread_cond_wait(&sync->cond, &sync->lock) ;
+            if(sync->stop) break ;
+        }
+        sync->kicked=0 ;
+        pthread_mutex_unlock(&sync->lock) ;
+
+        // Data written until now is committed by one sync
+        pthread_mutex_lock(&this->lock) ;
+        offset=sync->accepted ;
+        if(this->ring!=NULL) 
+        {
+            // Writer thread writes queued data and completes compressed 
+            // block first. Files retired before that are synced by it.
+            file_ring_wait_written(this) ;
+        }
+        else if(this->f!=NULL) fflush(this->f) ;
+        if(this->rotation!=NULL) file_rotation_wait_retired(this) ;
+        if(this->f!=NULL) fd=dup(fileno(this->f)) ;
+        pthread_mutex_unlock(&this->lock) ;
+
+        pthread_mutex_lock(&sync->lock) ;
+        if(fd<0) continue ;
+        pthread_mutex_unlock(&sync->lock) ;
+        clock_gettime(CLOCK_MONOTONIC, &start) ;
+        fdatasync(fd) ;
+        clock_gettime(CLOCK_MONOTONIC, &end) ;
+        close(fd) ;
+        ns=(end.tv_sec-start.tv_sec)*1000000000ull+end.tv_nsec-start.tv_nsec;
+        pthread_mutex_lock(&sync->lock) ;
+        if(offset>sync->synced) sync->synced=offset ;
+        sync->syncs++ ;
+        sync->last_ns=ns ;
+        if(ns>sync->max_ns) sync->max_ns=ns ;
+        sync->total_ns+=ns ;
+        sync->last_time=end ;
+    }
+    pthread_mutex_unlock(&sync->lock) ;
+    return NULL ;
+}
+
+// Count written bytes and request sync when bytes_limit is reached.
+// Call with file lock held.
+static inline void file_sync_account(struct file_data *this, int len)
+{
+    struct file_sync *sync=this->sync ;
+    sync->accepted+=len ;
+    if(sync->bytes_limit>0 
+       && sync->accepted-sync->requested>=sync->bytes_limit)
+    {
+        sync->requested=sync->accepted ;
+        pthread_mutex_lock(&sync->lock) ;
+        sync->kicked=1 ;
+        pthread_cond_signal(&sync->cond) ;
+        pthread_mutex_unlock(&sync->lock) ;
+    }
+}
+
+// Stop background sync. Call without file lock.
+static void file_sync_stop(struct file_data *this)
+{
+    struct file_sync *sync=this->sync ;
+    if(sync==NULL) return ;
+    pthread_mutex_lock(&sync->lock) ;
+    sync->stop=1 ;
+    pthread_cond_signal(&sync->cond) ;
+    pthread_mutex_unlock(&sync->lock) ;
+    pthread_join(sync->thread, NULL) ;
+    pthread_mutex_lock(&this->lock) ;
+    this->sync=NULL ;
+    pthread_mutex_unlock(&this->lock) ;
+    pthread_mutex_destroy(&sync->lock) ;
+    pthread_cond_destroy(&sync->cond) ;
+    free(sync) ;
+}
+
+// Start background sync. Call without file lock.
+static void file_sync_start(struct file_data *this, long interval_ms, 
+                            uint64_t bytes_limit)
+{
+    struct file_sync *sync ;
+    file_sync_stop(this) ;
+    if(interval_ms<=0 && bytes_limit==0) return ;
+    sync=calloc(1, sizeof(struct file_sync)) ;
+    if(sync==NULL) return ;
+    sync->interval_ms= interval_ms>0 ? interval_ms : 0 ;
+    sync->bytes_limit=bytes_limit ;
+    pthread_mutex_init(&sync->lock, NULL) ;
+    pthread_cond_init(&sync->cond, NULL) ;
+    pthread_mutex_lock(&this->lock) ;
+    this->sync=sync ;
+    if(pthread_create(&sync->thread, NULL, file_syncer, this)!=0)
+    {
+        printf("Could not start file sync thread!\r\n") ;
+        this->sync=NULL ;
+        pthread_mutex_destroy(&sync->lock) ;
+        pthread_cond_destroy(&sync->cond) ;
+        free(sync) ;
+    }
+    pthread_mutex_unlock(&this->lock) ;
+}
+
+// Start writing record of len bytes. Rotates file when needed, so the 
+// parts of the record go to the same file. Call with lock held.
+static inline void file_output_begin(struct file_data *this, int len)
+{
+    if(this->rotation!=NULL) file_rotate_check(this, len) ;
+    if(this->sync!=NULL) file_sync_account(this, len) ;
+}
+
+// Write part of record. Call with lock held.
+static inline void file_output_part(struct file_data *this, 
+                                    const char *data, int len)
+{
+    if(this->ring!=NULL) file_async_write(this, data, len) ;
+    else 
+    {
+        fwrite(data, 1, len, this->f) ;
+        this->unflushed+=len ;
+    }
+}
+
+// Flush written record according to flush policy. Call with lock held.
+static inline void file_output_end(struct file_data *this)
+{
+    if(this->ring!=NULL) 
+    {
+        if(__atomic_exchange_n(&this->flush_pending, 0, __ATOMIC_SEQ_CST))
+        {
+            file_ring_kick(this->ring, 1) ;
+        }
+        return ;
+    }
+    if(this->flush_policy==flush_write 
+       || (this->flush_policy==flush_bytes 
+           && this->unflushed>=this->flush_limit)
+       || __atomic_exchange_n(&this->flush_pending, 0, __ATOMIC_SEQ_CST))
+    {
+        fflush(this->f) ;
+        this->unflushed=0 ;
+    }
+}
+
+// Write data to file according to flush policy. Call with lock held.
+static void file_output(struct file_data *this, const char *data, int len)
+{
+    file_output_begin(this, len) ;
+    file_output_part(this, data, len) ;
+    file_output_end(this) ;
+}
+
+// Timestamp prefix of written records or lines
+struct file_stamp
+{
+    struct time_format format ;
+    char separator[16] ;
+    int lines ; // Prefix each line instead of each write
+    int line_start ; // Next written byte starts a line
+} ;
+
+// Write data prefixed with timestamp. Call with lock held.
+// Print current time and separator to prefix of 
+// TIME_FORMAT_LEN+sizeof(stamp->separator) bytes. Returns length.
+static int file_stamp_prefix(struct file_stamp *stamp, char *prefix)
+{
+    struct timespec now ;
+    int plen ;
+    clock_gettime(CLOCK_REALTIME, &now) ;
+    plen=time_format_print(&stamp->format, prefix, TIME_FORMAT_LEN, &now,
+                           timezone_offset) ;
+    strcpy(prefix+plen, stamp->separator) ;
+    return plen+strlen(stamp->separator) ;
+}
+
+static void file_output_stamped(struct file_data *this, 
+                                const char *data, int len)
+{
+    struct file_stamp *stamp=this->stamp ;
+    char prefix[TIME_FORMAT_LEN+sizeof(stamp->separator)] ;
+    int plen, start, end ;
+
+    if(stamp==NULL) 
+    {
+        file_output(this, data, len) ;
+        return ;
+    }
+    plen=file_stamp_prefix(stamp, prefix) ;
+
+    if(!stamp->lines)
+    {
+        file_output_begin(this, plen+len) ;
+        file_output_part(this, prefix, plen) ;
+        file_output_part(this, data, len) ;
+        file_output_end(this) ;
+        return ;
+    }
+    // Each line with its prefix
+    for(start=0 ; start<len ; start=end)
+    {
+        const char *newline=memchr(data+start, '\n', len-start) ;
+        end= newline!=NULL ? newline-data+1 : len ;
+        if(stamp->line_start)
+        {
+            file_output_begin(this, plen+end-start) ;
+            file_output_part(this, prefix, plen) ;
+        }
+        else file_output_begin(this, end-start) ;
+        file_output_part(this, data+start, end-start) ;
+        stamp->line_start= data[end-1]=='\n' ;
+    }
+    file_output_end(this) ;
+}
+
+#define FILE_ROW_CHUNK 512 // Bytes of row formatted at a time
+#define FILE_ROW_NUMBER 24 // Longest formatted number
+
+// Format numeric parameters from *index onward as delimited row into 
+// buffer of FILE_ROW_CHUNK bytes, until the buffer is full. Newline is 
+// added after the last number when enabled. Advances *index. Call with
+// lock held. Returns length.
+static int file_format_row(struct file_data *this, int paramtype, 
+                           union param_rmcios param, int num_params, 
+                           int *index, char *buffer)
+{
+    int len=0, seplen=strlen(this->row_separator) ;
+    for( ; *index<num_params ; (*index)++)
+    {
+        int i=*index ;
+        if(len+seplen+FILE_ROW_NUMBER+1>FILE_ROW_CHUNK) return len ;
+        if(i>0) 
+        {
+            memcpy(buffer+len, this->row_separator, seplen) ;
+            len+=seplen ;
+        }
+        if(paramtype==int_rmcios) len+=format_int(buffer+len, param.iv[i]) ;
+        else len+=format_float(buffer+len, param.fv[i]) ;
+    }
+    if(this->row_newline>0 || (this->row_newline<0 && num_params>1))
+    {
+        buffer[len++]='\n' ;
+    }
+    return len ;
+}
+
+// Write numeric parameters as one row. Long rows are formatted in pieces
+// and written as one record. Call with lock held.
+static void file_output_row(struct file_data *this, int paramtype, 
+                            union param_rmcios param, int num_params)
+{
+    struct file_stamp *stamp=this->stamp ;
+    char buffer[FILE_ROW_CHUNK] ;
+    char prefix[TIME_FORMAT_LEN+sizeof(stamp->separator)] ;
+    int index=0, len, total, plen=0 ;
+
+    len=file_format_row(this, paramtype, param, num_params, &index, buffer);
+    if(index==num_params)
+    {
+        file_output_stamped(this, buffer, len) ;
+        return ;
+    }
+    // Length of the whole row for rotation and sync accounting
+    for(total=len ; index<num_params ; )
+    {
+        total+=file_format_row(this, paramtype, param, num_params, &index, 
+                               buffer) ;
+    }
+    if(stamp!=NULL && (!stamp->lines || stamp->line_start))
+    {
+        plen=file_stamp_prefix(stamp, prefix) ;
+    }
+    file_output_begin(this, plen+total) ;
+    if(plen>0) file_output_part(this, prefix, plen) ;
+    for(index=0 ; index<num_params ; )
+    {
+        len=file_format_row(this, paramtype, param, num_params, &index, 
+                            buffer) ;
+        file_output_part(this, buffer, len) ;
+    }
+    if(stamp!=NULL) stamp->line_start= buffer[len-1]=='\n' ;
+    file_output_end(this) ;
+}
+
+// Map file opened for reading to memory. 
+// Returns NULL on failure (size=-1) or for empty file (size=0).
+static const char *file_map_fd(int fd, size_t *size)
+{
+    struct stat st ;
+    void *map ;
+    *size=(size_t)-1 ;
+    if(fstat(fd, &st)!=0) return NULL ;
+    if(st.st_size==0)
+    {
+        *size=0 ;
+        return NULL ;
+    }
+    map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+    if(map==MAP_FAILED) return NULL ;
+    madvise(map, st.st_size, MADV_SEQUENTIAL) ;
+    *size=st.st_size ;
+    return map ;
+}
+
+// Map file to memory for reading. 
+// Returns NULL on failure (size=-1) or for empty file (size=0).
+static const char *file_map(const char *filename, size_t *size)
+{
+    const char *map ;
+    int fd=open(filename, O_RDONLY | O_CLOEXEC) ;
+    *size=(size_t)-1 ;
+    if(fd<0) return NULL ;
+    map=file_map_fd(fd, size) ;
+    close(fd) ;
+    return map ;
+}
+
+// Send file to linked channels of id in chunks of chunk bytes.
+// Already sent pages are released so memory use stays constant.
+static void file_stream(const struct context_rmcios *context, int id,
+                        int fd, int chunk)
+{
+    size_t size, sent=0, released=0 ;
+    long page=sysconf(_SC_PAGESIZE) ;
+    const char *map=file_map_fd(fd, &size) ;
+    if(map==NULL) return ;
+    while(sent<size)
+    {
+        int len=(size-sent)<(size_t)chunk ? (int)(size-sent) : chunk ;
+        write_buffer(context, linked_channels(context, id), 
+                     map+sent, len, id) ;
+        sent+=len ;
+        if(sent-released>=(size_t)page*16)
+        {
+            size_t end=sent-sent%page ;
+            madvise((char *)map+released, end-released, MADV_DONTNEED) ;
+            released=end ;
+        }
+    }
+    munmap((void *)map, size) ;
+}
+
+// Close opened file. Call with lock held.
+static void file_close(struct file_data *this)
+{
+    file_async_stop(this) ;
+    file_rotation_stop(this) ;
+    if(this->sync!=NULL && this->f!=NULL)
+    {
+        // Commit the rest
+        fflush(this->f) ;
+        fdatasync(fileno(this->f)) ;
+        pthread_mutex_lock(&this->sync->lock) ;
+        this->sync->synced=this->sync->accepted ;
+        pthread_mutex_unlock(&this->sync->lock) ;
+    }
+    // Close the file if it exist:
+    if(this->f!=NULL) 
+    {   
+        fclose(this->f) ;
+        this->f=NULL ;
+    }
+    if(this->buffer!=NULL)
+    {
+        free(this->buffer) ;
+        this->buffer=NULL ;
+    }
+    free(this->filename) ;
+    this->filename=NULL ;
+    this->unflushed=0 ;
+}
+
+// Handle setup ch_name option ... Returns 0 when first parameter is not
+// an option name.
+static int file_setup_option(struct file_data *this,
+                             const struct context_rmcios *context, 
+                             int paramtype, int num_params,
+                             union param_rmcios param)
+{
+    if(param_is_keyword(context, paramtype, param, 0, "flush"))
+    {
+        long limit=0 ;
+        if(num_params>2) limit=param_to_int(context, paramtype, param, 2) ;
+        if(num_params<2 || param_is_keyword(context, paramtype, param, 1, 
+                                            "write")) 
+        {
+            file_set_flush(this, flush_write, 0) ;
+        }
+        else if(param_is_keyword(context, paramtype, param, 1, "bytes"))
+        {
+            file_set_flush(this, flush_bytes, limit) ;
+        }
+        else if(param_is_keyword(context, paramtype, param, 1, "ms"))
+        {
+            file_set_flush(this, flush_time, limit) ;
+        }
+        else if(param_is_keyword(context, paramtype, param, 1, "manual"))
+        {
+            file_set_flush(this, flush_manual, 0) ;
+        }
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "async"))
+    {
+        pthread_mutex_lock(&this->lock) ;
+        file_async_stop(this) ;
+        this->async_size=0 ;
+        this->overflow=overflow_block ;
+        if(num_params>1) 
+        {
+            this->async_size=param_to_int(context, paramtype, param, 1) ;
+        }
+        if(num_params>2)
+        {
+            if(param_is_keyword(context, paramtype, param, 2, "drop_oldest"))
+            {
+                this->overflow=overflow_drop_oldest ;
+            }
+            else if(param_is_keyword(context, paramtype, param, 2, 
+                                     "drop_newest"))
+            {
+                this->overflow=overflow_drop_newest ;
+            }
+        }
+        if(file_async_start(this)!=0)
+        {
+            // Compressed file can not be written without writer
+            printf("Could not start compressed writer, closing %s\r\n", 
+                   this->filename) ;
+            file_close(this) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "compress"))
+    {
+        enum file_compression compression=compress_none ;
+        if(num_params>1 
+           && param_is_keyword(context, paramtype, param, 1, "gzip"))
+        {
+            compression=compress_gzip ;
+#ifndef HAVE_ZLIB
+            printf("gzip compression is not available (HAVE_ZLIB)\r\n") ;
+            return 1 ;
+#endif
+        }
+        else if(num_params>1 
+                && param_is_keyword(context, paramtype, param, 1, "zstd"))
+        {
+            compression=compress_zstd ;
+#ifndef HAVE_ZSTD
+            printf("zstd compression is not available (HAVE_ZSTD)\r\n") ;
+            return 1 ;
+#endif
+        }
+        int level= num_params>2 ? 
+                   param_to_int(context, paramtype, param, 2) : -1 ;
+        int block= num_params>3 ? 
+                   param_to_int(context, paramtype, param, 3) : 1024*1024 ;
+        if((compression==compress_gzip && level>9) 
+           || level<-1 || block<=0)
+        {
+            printf("Invalid compression level or block size\r\n") ;
+            return 1 ;
+        }
+        pthread_mutex_lock(&this->lock) ;
+        {
+            enum file_compression old_compression=this->compression ;
+            int old_level=this->compress_level ;
+            int old_block=this->compress_block ;
+            file_async_stop(this) ;
+            this->compression=compression ;
+            this->compress_level=level ;
+            this->compress_block=block ;
+            if(file_async_start(this)!=0)
+            {
+                // Keep writing as before
+                printf("Could not start file compression, "
+                       "setup refused\r\n") ;
+                this->compression=old_compression ;
+                this->compress_level=old_level ;
+                this->compress_block=old_block ;
+                if(file_async_start(this)!=0) file_close(this) ;
+            }
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "row"))
+    {
+        pthread_mutex_lock(&this->lock) ;
+        strcpy(this->row_separator, ",") ;
+        if(num_params>1)
+        {
+            param_to_string(context, paramtype, param, 1, 
+                            sizeof(this->row_separator), 
+                            this->row_separator) ;
+        }
+        this->row_newline= num_params>2 ? 
+                           param_to_int(context, paramtype, param, 2)!=0 : -1;
+        __atomic_store_n(&this->row, 1, __ATOMIC_RELAXED) ;
+        pthread_mutex_unlock(&this->lock) ;
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "timestamp"))
+    {
+        struct file_stamp *stamp=NULL ;
+        if(num_params>1) stamp=malloc(sizeof(struct file_stamp)) ;
+        if(stamp!=NULL)
+        {
+            char format[TIME_FORMAT_LEN] ;
+            int decimals=0 ;
+            param_to_string(context, paramtype, param, 1, 
+                            sizeof(format), format) ;
+            if(num_params>2) 
+            {
+                decimals=param_to_int(context, paramtype, param, 2) ;
+            }
+            time_format_compile(&stamp->format, format, decimals) ;
+            strcpy(stamp->separator, " ") ;
+            if(num_params>3)
+            {
+                param_to_string(context, paramtype, param, 3, 
+                                sizeof(stamp->separator), stamp->separator);
+            }
+            stamp->lines= num_params>4 
+                          && param_is_keyword(context, paramtype, param, 4, 
+                                              "line") ;
+            stamp->line_start=1 ;
+        }
+        pthread_mutex_lock(&this->lock) ;
+        free(this->stamp) ;
+        this->stamp=stamp ;
+        pthread_mutex_unlock(&this->lock) ;
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "sync"))
+    {
+        long interval_ms=0 ;
+        uint64_t bytes_limit=0 ;
+        if(num_params>1) 
+        {
+            interval_ms=param_to_int(context, paramtype, param, 1) ;
+        }
+        if(num_params>2) 
+        {
+            double limit=param_to_double(context, paramtype, param, 2) ;
+            bytes_limit= limit>0 ? (uint64_t)limit : 0 ;
+        }
+        file_sync_start(this, interval_ms, bytes_limit) ;
+        return 1 ;
+    }
+    if(param_is_keyword(context, paramtype, param, 0, "buffer"))
+    {
+        if(num_params>1) 
+        {
+            this->buffer_size=param_to_int(context, paramtype, param, 1) ;
+        }
+        return 1 ;
+    }
+    return 0 ;
+}
+
+// Open file with buffering and writer options. Creates missing 
+// directories. Call with lock held.
+static void file_open(struct file_data *this, const char *filename, 
+                      const char *mode)
+{
+    // Create directory if it dosent exist
+    file_make_dirs(filename) ;
+    this->f=fopen(filename, mode) ;
+    if(this->f==NULL) 
+    {
+        printf("Could not open file %s\r\n", filename) ;
+        return ;
+    }
+    this->filename=strdup(filename) ;
+    if(this->buffer_size>0)
+    {
+        this->buffer=malloc(this->buffer_size) ;
+        if(this->buffer!=NULL)
+        {
+            setvbuf(this->f, this->buffer, _IOFBF, this->buffer_size) ;
+        }
+    }
+    if(file_async_start(this)!=0)
+    {
+        printf("Could not start compressed writer for %s\r\n", filename) ;
+        fclose(this->f) ;
+        this->f=NULL ;
+        free(this->buffer) ;
+        this->buffer=NULL ;
+        free(this->filename) ;
+        this->filename=NULL ;
+    }
+}
+
+// Open file named by strftime pattern and rotate it every period seconds
+// and/or when it reaches max_bytes. Call with lock held.
+static void file_rotation_start(struct file_data *this, const char *pattern,
+                                long period, uint64_t max_bytes, 
+                                const char *mode)
+{
+    struct file_rotation *rot=calloc(1, sizeof(struct file_rotation)) ;
+    struct file_successor first ;
+    time_t now=time(NULL) ;
+    if(rot==NULL) return ;
+    time_format_compile(&rot->format, pattern, 0) ;
+    snprintf(rot->mode, sizeof(rot->mode), "%s", mode) ;
+    rot->period= period>0 ? period : 0 ;
+    rot->max_bytes=max_bytes ;
+    rot->buffer_size=this->buffer_size ;
+    pthread_mutex_init(&rot->lock, NULL) ;
+    pthread_cond_init(&rot->cond, NULL) ;
+    pthread_cond_init(&rot->retired_cond, NULL) ;
+    if(rot->period>0) rot->rotate_at=file_rotation_boundary(rot, now) ;
+
+    // First file through normal open for buffering and async writer
+    if(file_successor_open(rot, &first, 
+                           rot->period>0 ? rot->rotate_at-rot->period : now,
+                           NULL, 0)!=0)
+    {
+        pthread_mutex_destroy(&rot->lock) ;
+        pthread_cond_destroy(&rot->cond) ;
+        pthread_cond_destroy(&rot->retired_cond) ;
+        free(rot) ;
+        return ;
+    }
+    fclose(first.f) ;
+    free(first.buffer) ;
+    file_open(this, first.filename, rot->mode) ;
+    free(first.filename) ;
+    rot->base=first.base ;
+    rot->written=first.size ; // Appending to existing file
+    if(this->f==NULL || pthread_create(&rot->thread, NULL, file_rotator, 
+                                       rot)!=0)
+    {
+        pthread_mutex_destroy(&rot->lock) ;
+        pthread_cond_destroy(&rot->cond) ;
+        pthread_cond_destroy(&rot->retired_cond) ;
+        free(rot->base) ;
+        free(rot) ;
+        return ;
+    }
+    this->rotation=rot ;
+}
+
+void file_class_func(struct file_data *this, 
+                     const struct context_rmcios *context, 
+                     int id, enum type_rmcios function,
+                     int paramtype,union param_rmcios returnv, 
+                     int num_params,union param_rmcios param)
+{
+const char *s ;
+int plen ;
+switch(function)
+{
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "file channel help\r\n"
+                      " create file ch_name\r\n"
+                      " setup ch_name filename | mode=a" 
+                      " setup ch_name \r\n #Close file \r\n"
+                      " setup ch_name flush write\r\n"
+                      "   #Flush after every write (default)\r\n"
+                      " setup ch_name flush bytes n\r\n"
+                      "   #Flush when n bytes has been written\r\n"
+                      " setup ch_name flush ms t\r\n"
+                      "   #Flush every t milliseconds\r\n"
+                      " setup ch_name flush manual\r\n"
+                      "   #Flush only on write without data\r\n"
+                      " setup ch_name rotate pattern | period(3600)\r\n"
+                      "     | max_bytes(0) | mode=a\r\n"
+                      "   #Open file named by strftime pattern and change\r\n"
+                      "   #to new file on multiples of period seconds\r\n"
+                      "   #(local time, 0=never) and when file would grow\r\n"
+                      "   #over max_bytes (0=no limit). Repeated names get\r\n"
+                      "   #suffix .1, .2 ... Next files are opened in\r\n"
+                      "   #background before they are needed.\r\n"
+                      " setup ch_name timestamp format | decimals(0)\r\n"
+                      "     | separator(\" \") | per(write)\r\n"
+                      "   #Prefix written data with time in rtc_str\r\n"
+                      "   #format. per: write or line. Without format\r\n"
+                      "   #timestamps are not written.\r\n"
+                      " setup ch_name sync ms | bytes(0)\r\n"
+                      "   #Commit written data to disk with fdatasync in\r\n"
+                      "   #background every ms milliseconds and when\r\n"
+                      "   #bytes have been written. 0 0 disables.\r\n"
+                      " setup ch_name buffer size\r\n"
+                      "   #Set write buffer size for next opened file\r\n"
+                      " setup ch_name async size | overflow(block)\r\n"
+                      "   #Write from background thread through queue of\r\n"
+                      "   #size bytes. size=0 writes synchronously.\r\n"
+                      "   #overflow: block, drop_oldest or drop_newest\r\n"
+                      " setup ch_name compress gzip|zstd|none | level\r\n"
+                      "     | block_size(1048576)\r\n"
+                      "   #Compress output in background thread into\r\n"
+                      "   #independent blocks. Block is completed when\r\n"
+                      "   #full, on flush request (manual or ms policy)\r\n"
+                      "   #and on close. Write queue is two blocks unless\r\n"
+                      "   #set with async. Setup is refused when the\r\n"
+                      "   #compressor can not be started.\r\n"
+                      " setup ch_name row separator(,) | newline\r\n"
+                      "   #Write all numbers of int and float writes\r\n"
+                      "   #as row separated by separator. Otherwise\r\n"
+                      "   #only the first number is written. newline=1\r\n"
+                      "   #ends every row with newline, newline=0 none.\r\n"
+                      "   #Default ends rows of more than one number.\r\n"
+                      " write ch_name file data # write data to file\r\n"
+                      " write ch_name # flush written data to file\r\n"
+                      " link ch_name filename\r\n"
+                      " read file filename\r\n"
+                      "   #Returns contents of the file\r\n"
+                      " read ch_name stream | chunk_size(4096)\r\n"
+                      "   #Send opened file to linked channels in chunks\r\n"
+                      " read ch_name async\r\n"
+                      "   #queue depth, dropped bytes and high water mark\r\n"
+                      " read ch_name rotate\r\n"
+                      "   #rotations, rotations that opened file on write\r\n"
+                      "   #and current filename\r\n"
+                      " read ch_name sync\r\n"
+                      "   #Bytes committed to disk, bytes not committed,\r\n"
+                      "   #time since last commit and fdatasync latency\r\n"
+                      " read ch_name compress\r\n"
+                      "   #uncompressed and compressed bytes written\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+
+        this=  (struct file_data *) malloc(sizeof( struct file_data)) ; 
+        if(this==NULL) break ;
+        file_data_init(this) ;
+        this->id=create_channel_param(context, paramtype, param, 0,
+                                      (class_rmcios)file_class_func, 
+                                      this ) ;
+        break ;
+
+    case setup_rmcios:
+        if(this==NULL) break ;
+        if(num_params>0 && file_setup_option(this, context, paramtype, 
+                                             num_params, param)) break ;
+
+        pthread_mutex_lock(&this->lock) ;
+        file_close(this) ;
+        if(num_params>1 
+           && param_is_keyword(context, paramtype, param, 0, "rotate"))
+        {
+            int plen=param_string_alloc_size(context, paramtype, param, 1) ;
+            char pattern[plen] ;
+            char mode[5]="a" ;
+            long period=3600 ;
+            uint64_t max_bytes=0 ;
+            if(num_params>2) 
+            {
+                period=param_to_int(context, paramtype, param, 2) ;
+            }
+            if(num_params>3) 
+            {
+                max_bytes=param_to_double(context, paramtype, param, 3) ;
+            }
+            if(num_params>4) 
+            {
+                param_to_string(context, paramtype, param, 4, 
+                                sizeof(mode), mode) ;
+            }
+            file_rotation_start(this, param_to_string(context, paramtype, 
+                                                      param, 1, plen, 
+                                                      pattern),
+                                period, max_bytes, mode) ;
+            pthread_mutex_unlock(&this->lock) ;
+            break ;
+        }
+        if(num_params>0)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            char mode[5]="a" ;
+            if(num_params>1) 
+            {
+                param_to_string(context, paramtype, param, 1, 
+                                sizeof(mode), mode) ;
+            }
+            file_open(this, param_to_string(context, paramtype, param, 0, 
+                                            namelen, namebuffer), mode) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+
+        break ;
+    case write_rmcios:
+        if(this==NULL) break ;
+        if(this->f==NULL )  break ;
+
+        if(num_params<1) 
+        {
+            pthread_mutex_lock(&this->lock) ;
+            if(this->ring!=NULL) file_ring_wait_written(this) ;
+            else if(this->f!=NULL) fflush(this->f) ;
+            this->unflushed=0 ;
+            pthread_mutex_unlock(&this->lock) ;
+        }
+        else if((paramtype==int_rmcios || paramtype==float_rmcios)
+                && __atomic_load_n(&this->row, __ATOMIC_RELAXED))
+        {
+            // Numbers are formatted directly as a row
+            pthread_mutex_lock(&this->lock) ;
+            if(this->f!=NULL) 
+            {
+                file_output_row(this, paramtype, param, num_params) ;
+            }
+            pthread_mutex_unlock(&this->lock) ;
+        }
+        else 
+        {
+            // Determine the needed buffer size
+            plen= param_string_alloc_size(context, paramtype, param, 0) ; 
+            {
+                char buffer[plen] ; // allocate buffer
+                s=param_to_string(context, paramtype,param, 0, 
+                                  plen, buffer) ;
+                pthread_mutex_lock(&this->lock) ;
+                if(this->f!=NULL) file_output_stamped(this, s, strlen(s)) ;
+                pthread_mutex_unlock(&this->lock) ;
+            }
+        }
+
+        break ;
+    case read_rmcios:
+        if(this!=NULL && num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "async"))
+        {
+            char stats[96] ;
+            uint64_t depth=0, dropped=0, high_water=0 ;
+            pthread_mutex_lock(&this->lock) ;
+            if(this->ring!=NULL)
+            {
+                struct file_ring *ring=this->ring ;
+                depth=__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+                      -__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ;
+                dropped=__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) ;
+                high_water=__atomic_load_n(&ring->high_water, 
+                                           __ATOMIC_RELAXED) ;
+            }
+            pthread_mutex_unlock(&this->lock) ;
+            snprintf(stats, sizeof(stats), 
+                     "%" PRIu64 " %" PRIu64 " %" PRIu64, 
+                     depth, dropped, high_water) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        if(this!=NULL && num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "sync"))
+        {
+            char stats[192] ;
+            stats[0]=0 ;
+            pthread_mutex_lock(&this->lock) ;
+            if(this->sync!=NULL)
+            {
+                struct file_sync *sync=this->sync ;
+                struct timespec now ;
+                uint64_t accepted=sync->accepted, age_ms=0 ;
+                clock_gettime(CLOCK_MONOTONIC, &now) ;
+                pthread_mutex_lock(&sync->lock) ;
+                if(sync->syncs>0)
+                {
+                    age_ms=(now.tv_sec-sync->last_time.tv_sec)*1000
+                           +(now.tv_nsec-sync->last_time.tv_nsec)/1000000 ;
+                }
+                snprintf(stats, sizeof(stats), 
+                         "synced=%" PRIu64 " pending=%" PRIu64 
+                         " age_ms=%" PRIu64 " syncs=%" PRIu64 
+                         " last=%" PRIu64 " mean=%" PRIu64 " max=%" PRIu64,
+                         sync->synced, accepted-sync->synced, age_ms, 
+                         sync->syncs, sync->last_ns, 
+                         sync->syncs>0 ? sync->total_ns/sync->syncs : 0, 
+                         sync->max_ns) ;
+                pthread_mutex_unlock(&sync->lock) ;
+            }
+            pthread_mutex_unlock(&this->lock) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        if(this!=NULL && num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "rotate"))
+        {
+            char stats[TIME_FORMAT_LEN+64] ;
+            pthread_mutex_lock(&this->lock) ;
+            if(this->rotation!=NULL)
+            {
+                snprintf(stats, sizeof(stats), 
+                         "%" PRIu64 " %" PRIu64 " %s", 
+                         this->rotation->rotations, 
+                         this->rotation->sync_opens, 
+                         this->filename!=NULL ? this->filename : "") ;
+            }
+            else stats[0]=0 ;
+            pthread_mutex_unlock(&this->lock) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        if(this!=NULL && num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "compress"))
+        {
+            char stats[64] ;
+            uint64_t bytes_in=0, bytes_out=0 ;
+            pthread_mutex_lock(&this->lock) ;
+            if(this->ring!=NULL && this->ring->compressor!=NULL)
+            {
+                struct file_compressor *c=this->ring->compressor ;
+                bytes_in=__atomic_load_n(&c->bytes_in, __ATOMIC_RELAXED) ;
+                bytes_out=__atomic_load_n(&c->bytes_out, __ATOMIC_RELAXED) ;
+            }
+            pthread_mutex_unlock(&this->lock) ;
+            snprintf(stats, sizeof(stats), "%" PRIu64 " %" PRIu64, 
+                     bytes_in, bytes_out) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        if(this!=NULL && num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "stream"))
+        {
+            int chunk=4096 ;
+            int fd=-1 ;
+            if(num_params>1) chunk=param_to_int(context, paramtype, param, 1);
+            pthread_mutex_lock(&this->lock) ;
+            if(this->ring!=NULL) file_ring_wait_written(this) ;
+            else if(this->f!=NULL) fflush(this->f) ;
+            if(this->f!=NULL && chunk>0)
+            {
+                // Open the written file itself for reading. It stays 
+                // readable when closed, rotated or renamed meanwhile.
+                char path[32] ;
+                snprintf(path, sizeof(path), "/proc/self/fd/%d", 
+                         fileno(this->f)) ;
+                fd=open(path, O_RDONLY | O_CLOEXEC) ;
+            }
+            pthread_mutex_unlock(&this->lock) ;
+            if(fd>=0) 
+            {
+                file_stream(context, this->id, fd, chunk) ;
+                close(fd) ;
+            }
+            break ;
+        }
+        if(this==NULL)
+        {
+            int namelen;
+            namelen=param_string_alloc_size(context, paramtype,param, 0) ;
+            {
+                char namebuffer[namelen] ;
+                const char *map ;
+                size_t fsize ;
+                s=param_to_string(context, paramtype,param, 0, 
+                                  namelen, namebuffer) ;
+
+                map=file_map(s, &fsize) ;
+                if(map==NULL)
+                {
+                    if(fsize==0) return_buffer(context, paramtype, returnv, 
+                                               "", 0) ;
+                    break ;
+                }
+                // Return the contents of the file in one call.
+                if(fsize>INT_MAX)
+                {
+                    printf("File %s is too large to read at once. "
+                           "Use read ch_name stream\r\n", s) ;
+                }
+                else return_buffer(context, paramtype,returnv,map,fsize) ;
+                munmap((void *)map, fsize) ;
+            }
+        }
+
+        break ;
+}
+}
+
+/////////////////////////////////////////////////////////
+// Clock to get elapsed time            
+/////////////////////////////////////////////////////////
+enum clock_unit
+{
+    unit_seconds,  // float seconds
+    unit_ns,       // int64 nanoseconds
+    unit_double    // double seconds
+} ;
+
+struct clock_data 
+{
+    uint64_t start ; // ns
+    clockid_t source ;
+    enum clock_unit unit ;
+} ;
+
+static uint64_t clock_ns(clockid_t source)
+{
+    struct timespec ts;
+    clock_gettime(source, &ts);
+    return (uint64_t)ts.tv_nsec + (uint64_t)ts.tv_sec * 1000000000ull;
+}
+
+// Return elapsed time and optionally send it to channel
+static void clock_output(struct clock_data *this, 
+                         const struct context_rmcios *context,
+                         int paramtype, union param_rmcios returnv, 
+                         uint64_t elapsed, int channel)
+{
+    char buffer[32] ;
+    switch(this->unit)
+    {
+        case unit_seconds:
+            return_float(context, paramtype, returnv, elapsed/1E9) ;
+            if(channel!=0) write_f(context, channel, elapsed/1E9) ;
+            return ;
+        case unit_ns:
+            snprintf(buffer, sizeof(buffer), "%" PRIu64, elapsed) ;
+            break ;
+        case unit_double:
+            snprintf(buffer, sizeof(buffer), "%" PRIu64 ".%09" PRIu64, 
+                     elapsed/1000000000, elapsed%1000000000) ;
+            break ;
+    }
+    return_string(context, paramtype, returnv, buffer) ;
+    if(channel!=0) write_str(context, channel, buffer, 0) ;
+}
+
+void clock_class_func(struct clock_data *this, 
+                      const struct context_rmcios *context, 
+                      int id, enum type_rmcios function,
+                      int paramtype, union param_rmcios returnv, 
+                      int num_params,union param_rmcios param)
+{
+ switch(function)
+ {   
+     case help_rmcios:
+         return_string(context,paramtype,returnv,
+                       "clock channel help\r\n"
+                       " create clock ch_name\r\n"
+                       " setup ch_name unit(s) | source(monotonic)\r\n"
+                       "   #unit: s (float seconds), ns (integer ns)\r\n"
+                       "   #      or double (double precision seconds)\r\n"
+                       "   #source: monotonic, monotonic_raw or boottime\r\n"
+                       " read ch_name \r\n"
+                       "   #reads elapsed time\r\n"
+                       " write ch_name \r\n"
+                       "   #read time, send to linked and reset time\r\n"
+                       " link ch_name linked #link time output on reset\r\n"
+                       ) ;
+         break ;
+
+     case create_rmcios:
+         if(num_params<1) break ;
+         this=  (struct clock_data *) malloc(sizeof( struct clock_data)) ;
+         if(this==NULL) break ;
+         create_channel_param(context, paramtype,param,0 ,
+                 (class_rmcios)clock_class_func, this) ;
+         //default values :
+         this->source=CLOCK_MONOTONIC ;
+         this->unit=unit_seconds ;
+         this->start= clock_ns(this->source) ;
+         break ;
+
+     case setup_rmcios:
+         if(this==NULL) break ;
+         if(num_params>0)
+         {
+             if(param_is_keyword(context, paramtype, param, 0, "ns"))
+             {
+                 this->unit=unit_ns ;
+             }
+             else if(param_is_keyword(context, paramtype, param, 0, 
+                                      "double"))
+             {
+                 this->unit=unit_double ;
+             }
+             else this->unit=unit_seconds ;
+         }
+         if(num_params>1)
+         {
+             if(param_is_keyword(context, paramtype, param, 1, 
+                                 "monotonic_raw"))
+             {
+                 this->source=CLOCK_MONOTONIC_RAW ;
+             }
+             else if(param_is_keyword(context, paramtype, param, 1, 
+                                      "boottime"))
+             {
+                 this->source=CLOCK_BOOTTIME ;
+             }
+             else this->source=CLOCK_MONOTONIC ;
+             this->start=clock_ns(this->source) ;
+         }
+         break ;
+
+     case read_rmcios:
+         if(this==NULL) break ;
+         clock_output(this, context, paramtype, returnv, 
+                      clock_ns(this->source)-this->start, 0) ;
+         break ;
+     
+     case write_rmcios:
+         if(this==NULL) break ;
+         else
+         {
+             uint64_t ticknow ;
+             ticknow=clock_ns(this->source);
+             clock_output(this, context, paramtype, returnv, 
+                          ticknow-this->start, 
+                          linked_channels(context, id)) ;
+             this->start=ticknow ;
+         }
+         break ; 
+ }
+}
+
+///////////////////////////////////////////////////////
+// Binary log                                        
+///////////////////////////////////////////////////////
+// Appends fixed size binary records to file. File starts with header:
+//  struct binlog_header
+//  format string: NUL terminated, padded to multiple of 8 bytes.
+//    Space separated fields of record after the timestamp:
+//    i=int32, f=float32, bN=N bytes (zero padded)
+// Each record: int64 timestamp (CLOCK_REALTIME ns) and fields, packed.
+// Numbers are in byte order of the writer (see byte_order).
+#define BINLOG_MAGIC "RMCIOSBL"
+#define BINLOG_MAX_FIELDS 64
+#define BINLOG_FORMAT_SIZE (BINLOG_MAX_FIELDS*7)
+#define BINLOG_MAX_RECORD 4096 // Bytes including timestamp
+
+struct binlog_header
+{
+    char magic[8] ;
+    uint32_t byte_order ; // 0x01020304
+    uint16_t version ; // 1
+    uint16_t header_size ; // Bytes including format string
+    uint32_t record_size ; // Bytes per record including timestamp
+    uint32_t fields ; // Fields after timestamp
+} ;
+
+struct binlog_data
+{
+    struct file_data file ;
+    int fields ;
+    char type[BINLOG_MAX_FIELDS] ; // 'i', 'f' or 'b'
+    int size[BINLOG_MAX_FIELDS] ; // Field sizes
+    int record_size ;
+    char format[BINLOG_FORMAT_SIZE] ; // Normalized format string
+} ;
+
+// Parse format such as "iffb16" or "i f f b16". Returns number of fields,
+// or -1 for invalid format, too many fields or too long record.
+static int binlog_parse_format(struct binlog_data *this, const char *format)
+{
+    int len=0 ;
+    this->fields=0 ;
+    this->record_size=sizeof(int64_t) ;
+    this->format[0]=0 ;
+    while(*format)
+    {
+        char type=*format++ ;
+        int size ;
+        if(type==' ' || type==',') continue ;
+        if(this->fields==BINLOG_MAX_FIELDS) return -1 ;
+        if(type=='i') size=sizeof(int32_t) ;
+        else if(type=='f') size=sizeof(float) ;
+        else if(type=='b') 
+        {
+            size=strtol(format, (char **)&format, 10) ;
+            if(size<=0 || size>BINLOG_MAX_RECORD) return -1 ;
+        }
+        else return -1 ;
+        if(this->record_size+size>BINLOG_MAX_RECORD) return -1 ;
+        this->type[this->fields]=type ;
+        this->size[this->fields]=size ;
+        this->fields++ ;
+        this->record_size+=size ;
+        if(type=='b') 
+        {
+            len+=snprintf(this->format+len, sizeof(this->format)-len, 
+                          "%sb%d", len>0 ? " " : "", size) ;
+        }
+        else 
+        {
+            len+=snprintf(this->format+len, sizeof(this->format)-len, 
+                          "%s%c", len>0 ? " " : "", type) ;
+        }
+    }
+    return this->fields ;
+}
+
+// Write header to new file or check that header of existing file has 
+// the same format. Call with lock held. Returns 0 on success.
+static int binlog_header(struct binlog_data *this)
+{
+    int formatlen=(strlen(this->format)+1+7)&~7 ;
+    int size=sizeof(struct binlog_header)+formatlen ;
+    char header[size] ;
+    struct binlog_header *h=(struct binlog_header *)header ;
+    memset(header, 0, size) ;
+    memcpy(h->magic, BINLOG_MAGIC, sizeof(h->magic)) ;
+    h->byte_order=0x01020304 ;
+    h->version=1 ;
+    h->header_size=size ;
+    h->record_size=this->record_size ;
+    h->fields=this->fields ;
+    strcpy(header+sizeof(struct binlog_header), this->format) ;
+
+    fseek(this->file.f, 0, SEEK_END) ;
+    if(ftell(this->file.f)==0) 
+    {
+        file_output(&this->file, header, size) ;
+        return 0 ;
+    }
+    else
+    {
+        char existing[size] ;
+        rewind(this->file.f) ;
+        if(fread(existing, 1, size, this->file.f)!=(size_t)size 
+           || memcmp(existing, header, size)!=0)
+        {
+            printf("Binary log %s has different format\r\n", 
+                   this->file.filename) ;
+            return -1 ;
+        }
+    }
+    return 0 ;
+}
+
+void binlog_class_func(struct binlog_data *this, 
+                       const struct context_rmcios *context, 
+                       int id, enum function_rmcios function,
+                       enum type_rmcios paramtype,
+                       union param_rmcios returnv, 
+                       int num_params, union param_rmcios param)
+{
+    switch(function)
+    {
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "binlog channel help\r\n"
+                      " create binlog ch_name\r\n"
+                      " setup ch_name filename format\r\n"
+                      "   #Open file for appending records of format.\r\n"
+                      "   #format fields: i=int32, f=float32,\r\n"
+                      "   #bN=N bytes. example: iffb16\r\n"
+                      "   #At most 64 fields and 4096 bytes per record.\r\n"
+                      "   #Record starts with int64 realtime timestamp (ns)\r\n"
+                      "   #Existing file must have the same format.\r\n"
+                      " setup ch_name \r\n #Close file \r\n"
+                      " setup ch_name flush|buffer|async|sync ...\r\n"
+                      "   #Write options as in file channel, except\r\n"
+                      "   #async overflow drop_oldest\r\n"
+                      " write ch_name value1 value2 ...\r\n"
+                      "   #Append record. Missing values are zero.\r\n"
+                      " write ch_name # flush written records to file\r\n"
+                      " read ch_name\r\n"
+                      "   #Returns record format\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+        this=(struct binlog_data *) malloc(sizeof(struct binlog_data)) ;
+        if(this==NULL) break ;
+        file_data_init(&this->file) ;
+        binlog_parse_format(this, "") ;
+        this->file.id=create_channel_param(context, paramtype, param, 0,
+                                           (class_rmcios)binlog_class_func, 
+                                           this ) ;
+        break ;
+
+    case setup_rmcios:
+        if(this==NULL) break ;
+        if(num_params>0 
+           && (param_is_keyword(context, paramtype, param, 0, "row")
+               || param_is_keyword(context, paramtype, param, 0, "timestamp")
+               || param_is_keyword(context, paramtype, param, 0, "compress")))
+        {
+            // Records are binary and the header is checked on reopen
+            printf("binlog does not support this option\r\n") ;
+            break ;
+        }
+        if(num_params>2 
+           && param_is_keyword(context, paramtype, param, 0, "async")
+           && param_is_keyword(context, paramtype, param, 2, "drop_oldest"))
+        {
+            // Dropping queued bytes would split records and the header
+            printf("binlog does not support drop_oldest overflow\r\n") ;
+            break ;
+        }
+        if(num_params>0 && file_setup_option(&this->file, context, 
+                                             paramtype, num_params, param))
+        {
+            break ;
+        }
+        pthread_mutex_lock(&this->file.lock) ;
+        file_close(&this->file) ;
+        if(num_params>0)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            char format[BINLOG_FORMAT_SIZE] ;
+            format[0]=0 ;
+            if(num_params>1)
+            {
+                param_to_string(context, paramtype, param, 1, 
+                                sizeof(format), format) ;
+            }
+            if(binlog_parse_format(this, format)<0)
+            {
+                printf("Invalid binary log format: %s\r\n", format) ;
+                binlog_parse_format(this, "") ;
+            }
+            else 
+            {
+                file_open(&this->file, 
+                          param_to_string(context, paramtype, param, 0, 
+                                          namelen, namebuffer), "a+b") ;
+                if(this->file.f!=NULL && binlog_header(this)!=0) 
+                {
+                    file_close(&this->file) ;
+                }
+            }
+        }
+        pthread_mutex_unlock(&this->file.lock) ;
+        break ;
+
+    case write_rmcios:
+        if(this==NULL) break ;
+        if(num_params<1) 
+        {
+            pthread_mutex_lock(&this->file.lock) ;
+            if(this->file.ring!=NULL) file_ring_wait_written(&this->file) ;
+            else if(this->file.f!=NULL) fflush(this->file.f) ;
+            this->file.unflushed=0 ;
+            pthread_mutex_unlock(&this->file.lock) ;
+            break ;
+        }
+        pthread_mutex_lock(&this->file.lock) ;
+        if(this->file.f!=NULL)
+        {
+            char record[BINLOG_MAX_RECORD] ;
+            char *field=record+sizeof(int64_t) ;
+            int64_t timestamp=clock_ns(CLOCK_REALTIME) ;
+            int i ;
+            memcpy(record, &timestamp, sizeof(timestamp)) ;
+            for(i=0 ; i<this->fields ; i++)
+            {
+                if(i>=num_params) memset(field, 0, this->size[i]) ;
+                else if(this->type[i]=='i')
+                {
+                    int32_t value=param_to_int(context, paramtype, param, i);
+                    memcpy(field, &value, sizeof(value)) ;
+                }
+                else if(this->type[i]=='f')
+                {
+                    float value=param_to_float(context, paramtype, param, i);
+                    memcpy(field, &value, sizeof(value)) ;
+                }
+                else if(paramtype==buffer_rmcios)
+                {
+                    // Binary data as is
+                    int len=param.bv[i].length ;
+                    if(len>this->size[i]) len=this->size[i] ;
+                    memcpy(field, param.bv[i].data, len) ;
+                    memset(field+len, 0, this->size[i]-len) ;
+                }
+                else
+                {
+                    char value[BINLOG_MAX_RECORD+1] ;
+                    param_to_string(context, paramtype, param, i, 
+                                    this->size[i]+1, value) ;
+                    strncpy(field, value, this->size[i]) ;
+                }
+                field+=this->size[i] ;
+            }
+            file_output(&this->file, record, this->record_size) ;
+        }
+        pthread_mutex_unlock(&this->file.lock) ;
+        break ;
+
+    case read_rmcios:
+        if(this==NULL) break ;
+        return_string(context, paramtype, returnv, this->format) ;
+        break ;
+
+    default:
+        break ;
+    }
+}
+
+///////////////////////////////////////////////////////
+// Ring file                                        
+///////////////////////////////////////////////////////
+// Fixed size preallocated file that is written circularly through 
+// memory mapping. First page holds struct ringfile_header, rest of the 
+// file is data area of length prefixed (uint32) records. When the data
+// area is full oldest records are dropped. Data is written before head 
+// is moved, so after a crash the file holds the records up to head.
+#define RINGFILE_MAGIC "RMCIOSRF"
+#define RINGFILE_HEADER_SIZE 4096
+
+struct ringfile_header
+{
+    char magic[8] ;
+    uint32_t version ; // 1
+    uint32_t header_size ; // Offset of data area
+    uint64_t data_size ; // Bytes in data area
+    uint64_t head ; // End of newest record (free running offset)
+    uint64_t tail ; // Start of oldest record (free running offset)
+    uint64_t newest ; // Start of newest record (free running offset)
+    uint64_t records ; // Records between tail and head
+} ;
+
+struct ringfile_data
+{
+    pthread_mutex_t lock ; 
+    int id ;
+    int fd ;
+    char *map ; // Whole file
+    size_t map_size ;
+    struct ringfile_header *header ; 
+    char *data ; // Data area in map
+    uint64_t size ; // Data area size
+    uint64_t dropped ; // Records overwritten or too large to fit
+    int sync_ms ; // Interval of background msync
+    pthread_t syncer ; 
+    int syncer_running ;
+    int stop ; 
+    pthread_mutex_t sync_lock ;
+    pthread_cond_t sync_cond ;
+} ;
+
+static void ringfile_copy_in(struct ringfile_data *this, uint64_t offset,
+                             const char *src, uint64_t len)
+{
+    uint64_t start=offset%this->size ;
+    uint64_t first= this->size-start<len ? this->size-start : len ;
+    memcpy(this->data+start, src, first) ;
+    memcpy(this->data, src+first, len-first) ;
+}
+
+static void ringfile_copy_out(struct ringfile_data *this, uint64_t offset,
+                              char *dst, uint64_t len)
+{
+    uint64_t start=offset%this->size ;
+    uint64_t first= this->size-start<len ? this->size-start : len ;
+    memcpy(dst, this->data+start, first) ;
+    memcpy(dst+first, this->data, len-first) ;
+}
+
+// Get length of record at offset. Returns -1 when the record does not
+// end at or before end, e.g. because the file is corrupted.
+static int ringfile_record(struct ringfile_data *this, uint64_t offset,
+                           uint64_t end, uint32_t *len)
+{
+    if(offset>end || end-offset<sizeof(uint32_t)) return -1 ;
+    ringfile_copy_out(this, offset, (char *)len, sizeof(*len)) ;
+    if(*len>end-offset-sizeof(uint32_t)) return -1 ;
+    return 0 ;
+}
+
+// Check records between tail and head. Keeps the valid records from 
+// tail and drops the rest. Call with lock held.
+static void ringfile_check(struct ringfile_data *this)
+{
+    struct ringfile_header *h=this->header ;
+    uint64_t offset=h->tail ;
+    uint64_t records=0 ;
+    uint64_t newest=h->tail ;
+    uint32_t len ;
+    while(offset<h->head && ringfile_record(this, offset, h->head, &len)==0)
+    {
+        newest=offset ;
+        offset+=sizeof(uint32_t)+len ;
+        records++ ;
+    }
+    if(offset!=h->head || records!=h->records 
+       || (records>0 && newest!=h->newest))
+    {
+        printf("Ring file has invalid records, kept %" PRIu64 "\r\n", 
+               records) ;
+        h->head=offset ;
+        h->records=records ;
+        h->newest=newest ;
+    }
+}
+
+// Append record. Call with lock held.
+static void ringfile_write(struct ringfile_data *this, 
+                           const char *data, uint32_t len)
+{
+    struct ringfile_header *h=this->header ;
+    uint64_t need=sizeof(uint32_t)+len ;
+    uint64_t tail=h->tail ;
+    if(need>this->size) 
+    {
+        this->dropped++ ;
+        return ;
+    }
+    // Drop oldest records to make space
+    while(h->head-tail+need>this->size)
+    {
+        uint32_t oldest ;
+        if(ringfile_record(this, tail, h->head, &oldest)!=0)
+        {
+            // Corrupted: drop all
+            this->dropped+=h->records ;
+            h->records=0 ;
+            tail=h->head ;
+            break ;
+        }
+        tail+=sizeof(uint32_t)+oldest ;
+        h->records-- ;
+        this->dropped++ ;
+    }
+    __atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE) ;
+    ringfile_copy_in(this, h->head, (char *)&len, sizeof(len)) ;
+    ringfile_copy_in(this, h->head+sizeof(uint32_t), data, len) ;
+    h->records++ ;
+    h->newest=h->head ;
+    __atomic_store_n(&h->head, h->head+need, __ATOMIC_RELEASE) ;
+}
+
+static void *ringfile_syncer(void *data)
+{
+    struct ringfile_data *this=data ;
+    pthread_mutex_lock(&this->sync_lock) ;
+    while(!this->stop)
+    {
+        struct timespec ts ;
+        clock_gettime(CLOCK_REALTIME, &ts) ;
+        ts.tv_sec+=this->sync_ms/1000 ;
+        ts.tv_nsec+=(this->sync_ms%1000)*1000000L ;
+        if(ts.tv_nsec>=1000000000L)
+        {
+            ts.tv_sec++ ;
+            ts.tv_nsec-=1000000000L ;
+        }
+        pthread_cond_timedwait(&this->sync_cond, &this->sync_lock, &ts) ;
+        if(this->stop) break ;
+        pthread_mutex_unlock(&this->sync_lock) ;
+        msync(this->map, this->map_size, MS_SYNC) ;
+        pthread_mutex_lock(&this->sync_lock) ;
+    }
+    pthread_mutex_unlock(&this->sync_lock) ;
+    return NULL ;
+}
+
+// Call with lock held.
+static void ringfile_close(struct ringfile_data *this)
+{
+    if(this->syncer_running)
+    {
+        pthread_mutex_lock(&this->sync_lock) ;
+        this->stop=1 ;
+        pthread_cond_signal(&this->sync_cond) ;
+        pthread_mutex_unlock(&this->sync_lock) ;
+        pthread_join(this->syncer, NULL) ;
+        this->syncer_running=0 ;
+        this->stop=0 ;
+    }
+    if(this->map!=NULL)
+    {
+        msync(this->map, this->map_size, MS_SYNC) ;
+        munmap(this->map, this->map_size) ;
+        this->map=NULL ;
+        this->header=NULL ;
+        this->data=NULL ;
+    }
+    if(this->fd>=0) close(this->fd) ;
+    this->fd=-1 ;
+}
+
+// Open or create ring file with data area of size bytes. Existing 
+// records are kept when the file has a valid header of the same size.
+// Call with lock held.
+static void ringfile_open(struct ringfile_data *this, const char *filename,
+                          uint64_t size)
+{
+    struct ringfile_header *h ;
+    struct stat st ;
+    this->fd=open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0666) ;
+    if(this->fd<0)
+    {
+        printf("Could not open file %s\r\n", filename) ;
+        return ;
+    }
+    this->map_size=RINGFILE_HEADER_SIZE+size ;
+    if(fstat(this->fd, &st)!=0 || (uint64_t)st.st_size<this->map_size)
+    {
+        int err=0 ;
+        if(fallocate(this->fd, 0, 0, this->map_size)!=0) 
+        {
+            err=posix_fallocate(this->fd, 0, this->map_size) ;
+        }
+        if(err!=0)
+        {
+            printf("Could not allocate %" PRIu64 " bytes for %s\r\n", 
+                   (uint64_t)this->map_size, filename) ;
+            ringfile_close(this) ;
+            return ;
+        }
+    }
+    this->map=mmap(NULL, this->map_size, PROT_READ | PROT_WRITE, 
+                   MAP_SHARED, this->fd, 0) ;
+    if(this->map==MAP_FAILED)
+    {
+        this->map=NULL ;
+        printf("Could not map file %s\r\n", filename) ;
+        ringfile_close(this) ;
+        return ;
+    }
+    h=this->header=(struct ringfile_header *)this->map ;
+    this->data=this->map+RINGFILE_HEADER_SIZE ;
+    this->size=size ;
+    if(memcmp(h->magic, RINGFILE_MAGIC, sizeof(h->magic))!=0 
+       || h->version!=1 || h->header_size!=RINGFILE_HEADER_SIZE
+       || h->data_size!=size || h->head<h->tail || h->head-h->tail>size)
+    {
+        // New file, or unusable contents
+        memset(h, 0, sizeof(struct ringfile_header)) ;
+        memcpy(h->magic, RINGFILE_MAGIC, sizeof(h->magic)) ;
+        h->version=1 ;
+        h->header_size=RINGFILE_HEADER_SIZE ;
+        h->data_size=size ;
+    }
+    else ringfile_check(this) ;
+    if(this->sync_ms>0)
+    {
+        this->syncer_running=
+            pthread_create(&this->syncer, NULL, ringfile_syncer, this)==0 ;
+    }
+}
+
+void ringfile_class_func(struct ringfile_data *this, 
+                         const struct context_rmcios *context, 
+                         int id, enum function_rmcios function,
+                         enum type_rmcios paramtype,
+                         union param_rmcios returnv, 
+                         int num_params, union param_rmcios param)
+{
+    switch(function)
+    {
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "ringfile channel help\r\n"
+                      " create ringfile ch_name\r\n"
+                      " setup ch_name filename size | sync_ms(1000)\r\n"
+                      "   #Open preallocated file with size bytes for\r\n"
+                      "   #records. Oldest records are overwritten when\r\n"
+                      "   #full. Records in existing file of the same\r\n"
+                      "   #size are kept. File is synced to disk every\r\n"
+                      "   #sync_ms milliseconds (0=only on close).\r\n"
+                      " setup ch_name \r\n #Close file \r\n"
+                      " write ch_name data # append record\r\n"
+                      " write ch_name # sync file to disk\r\n"
+                      " read ch_name\r\n"
+                      "   #Returns newest record\r\n"
+                      " read ch_name dump\r\n"
+                      "   #Send records oldest first to linked channels\r\n"
+                      " read ch_name stats\r\n"
+                      "   #records, bytes used, size and dropped records\r\n"
+                      "   #(overwritten, or too large to fit)\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+        this=(struct ringfile_data *) calloc(1, sizeof(struct ringfile_data));
+        if(this==NULL) break ;
+        pthread_mutex_init(&this->lock, NULL) ;
+        pthread_mutex_init(&this->sync_lock, NULL) ;
+        pthread_cond_init(&this->sync_cond, NULL) ;
+        this->fd=-1 ;
+        this->sync_ms=1000 ;
+        this->id=create_channel_param(context, paramtype, param, 0,
+                                      (class_rmcios)ringfile_class_func, 
+                                      this ) ;
+        break ;
+
+    case setup_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        ringfile_close(this) ;
+        if(num_params>1)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            double size=param_to_double(context, paramtype, param, 1) ;
+            if(num_params>2)
+            {
+                this->sync_ms=param_to_int(context, paramtype, param, 2) ;
+            }
+            if(size>=sizeof(uint32_t)+1)
+            {
+                ringfile_open(this, param_to_string(context, paramtype, 
+                                                    param, 0, namelen, 
+                                                    namebuffer), 
+                              (uint64_t)size) ;
+            }
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case write_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        if(this->map==NULL)
+        {
+            pthread_mutex_unlock(&this->lock) ;
+            break ;
+        }
+        if(num_params<1) msync(this->map, this->map_size, MS_SYNC) ;
+        else if(paramtype==buffer_rmcios)
+        {
+            ringfile_write(this, param.bv[0].data, param.bv[0].length) ;
+        }
+        else
+        {
+            int plen=param_string_alloc_size(context, paramtype, param, 0) ;
+            char buffer[plen] ;
+            const char *s=param_to_string(context, paramtype, param, 0, 
+                                          plen, buffer) ;
+            ringfile_write(this, s, strlen(s)) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case read_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        if(this->map==NULL)
+        {
+            pthread_mutex_unlock(&this->lock) ;
+            break ;
+        }
+        if(num_params>0 
+           && param_is_keyword(context, paramtype, param, 0, "stats"))
+        {
+            char stats[96] ;
+            snprintf(stats, sizeof(stats), 
+                     "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, 
+                     this->header->records, 
+                     this->header->head-this->header->tail, 
+                     this->size, this->dropped) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        else if(num_params>0 
+                && param_is_keyword(context, paramtype, param, 0, "dump"))
+        {
+            uint64_t offset=this->header->tail ;
+            char *record=NULL ;
+            while(offset<this->header->head)
+            {
+                uint32_t len ;
+                char *grown ;
+                if(ringfile_record(this, offset, this->header->head, 
+                                   &len)!=0) 
+                {
+                    printf("Ring file has invalid record\r\n") ;
+                    break ;
+                }
+                offset+=sizeof(len) ;
+                grown=realloc(record, len+1) ;
+                if(grown==NULL) break ;
+                record=grown ;
+                ringfile_copy_out(this, offset, record, len) ;
+                offset+=len ;
+                write_buffer(context, linked_channels(context, this->id), 
+                             record, len, this->id) ;
+            }
+            free(record) ;
+        }
+        else if(this->header->records>0)
+        {
+            uint64_t offset=this->header->newest ;
+            uint32_t len ;
+            char *record ;
+            if(offset<this->header->tail 
+               || ringfile_record(this, offset, this->header->head, &len)!=0
+               || offset+sizeof(len)+len!=this->header->head)
+            {
+                printf("Ring file has invalid newest record\r\n") ;
+            }
+            else if((record=malloc(len+1))!=NULL)
+            {
+                ringfile_copy_out(this, offset+sizeof(len), record, len) ;
+                return_buffer(context, paramtype, returnv, record, len) ;
+                free(record) ;
+            }
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    default:
+        break ;
+    }
+}
+
+///////////////////////////////////////////////////////
+// Follow - tail of growing file
+///////////////////////////////////////////////////////
+// Keeps file open and sends data appended to it to linked channels. 
+// inotify wakes the dispatcher on modification, so only new bytes are 
+// read. Truncated file is read again from start. When the file is 
+// renamed (rotated) the rest of the old file is read, and following 
+// continues from start of the new file with the same name.
+struct follow_data
+{
+    pthread_mutex_t lock ;
+    int id ;
+    char *filename ;
+    const char *basename ; // File name part of filename
+    int fd ; // Followed file, -1 when it does not exist
+    dev_t dev ;
+    ino_t ino ;
+    uint64_t offset ; // Read position in followed file
+    struct dispatch_source watch ; // inotify instance
+    struct dispatch_source more ; // eventfd, signaled while data is unread
+    int wd_file ; 
+    int wd_dir ; 
+    int lines ; // Send complete lines instead of chunks
+    int max_line ; // Longer lines are sent in parts
+    char *partial ; // Incomplete line
+    int partial_len ;
+    uint64_t bytes ; // Sent bytes
+    uint64_t truncations ;
+    uint64_t rotations ;
+} ;
+
+// Send line or chunk to linked channels. Call with lock held.
+static void follow_send(struct follow_data *this, const char *data, int len)
+{
+    write_buffer(module_context, linked_channels(module_context, this->id),
+                 data, len, this->id) ;
+}
+
+// Send incomplete line. Call with lock held.
+static void follow_send_partial(struct follow_data *this)
+{
+    if(this->partial_len>0) follow_send(this, this->partial, 
+                                        this->partial_len) ;
+    this->partial_len=0 ;
+}
+
+// Split read data to lines. Complete lines are sent directly from 
+// buffer, only the incomplete end is copied. Call with lock held.
+static void follow_lines(struct follow_data *this, const char *data, int len)
+{
+    while(len>0)
+    {
+        const char *end=memchr(data, '\n', len) ;
+        int n= end!=NULL ? end-data+1 : len ;
+        if(this->partial_len==0 && end!=NULL) follow_send(this, data, n) ;
+        else
+        {
+            int space=this->max_line-this->partial_len ;
+            if(n>space) 
+            {
+                // Too long line: send collected part
+                memcpy(this->partial+this->partial_len, data, space) ;
+                this->partial_len+=space ;
+                follow_send_partial(this) ;
+                n=space ;
+            }
+            else 
+            {
+                memcpy(this->partial+this->partial_len, data, n) ;
+                this->partial_len+=n ;
+                if(end!=NULL) follow_send_partial(this) ;
+            }
+        }
+        data+=n ;
+        len-=n ;
+    }
+}
+
+#define FOLLOW_READ_CHUNKS 4 // Chunks read per dispatcher wakeup
+
+// Read and send data from offset towards end of file. Reads at most 
+// FOLLOW_READ_CHUNKS chunks, so other sources of the dispatcher are not 
+// delayed by a large file. Call with lock held. Returns 1 when there may 
+// be more data to read.
+static int follow_read(struct follow_data *this)
+{
+    char buffer[65536] ;
+    ssize_t n ;
+    int chunks ;
+    for(chunks=0 ; chunks<FOLLOW_READ_CHUNKS ; chunks++)
+    {
+        n=pread(this->fd, buffer, sizeof(buffer), this->offset) ;
+        if(n<=0) return 0 ;
+        this->offset+=n ;
+        this->bytes+=n ;
+        if(this->lines) follow_lines(this, buffer, n) ;
+        else follow_send(this, buffer, n) ;
+        if(n<(ssize_t)sizeof(buffer)) return 0 ;
+    }
+    return 1 ;
+}
+
+// Continue reading on next dispatcher wakeup. Call with lock held.
+static void follow_continue(struct follow_data *this)
+{
+    uint64_t one=1 ;
+    if(write(this->more.fd, &one, sizeof(one))<0) return ;
+}
+
+// Open followed file and watch it. Call with lock held.
+static void follow_open_file(struct follow_data *this, int at_end)
+{
+    struct stat st ;
+    this->fd=open(this->filename, O_RDONLY | O_CLOEXEC) ;
+    if(this->fd<0) return ;
+    if(fstat(this->fd, &st)!=0) st.st_size=0 ;
+    this->dev=st.st_dev ;
+    this->ino=st.st_ino ;
+    this->offset= at_end ? (uint64_t)st.st_size : 0 ;
+    this->wd_file=inotify_add_watch(this->watch.fd, this->filename, 
+                                    IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                    IN_DELETE_SELF) ;
+}
+
+static void follow_close_file(struct follow_data *this)
+{
+    if(this->fd<0) return ;
+    if(this->wd_file>=0) inotify_rm_watch(this->watch.fd, this->wd_file) ;
+    this->wd_file=-1 ;
+    close(this->fd) ;
+    this->fd=-1 ;
+}
+
+// Send new data and check for truncation and rotation. 
+// Call with lock held.
+static void follow_poll(struct follow_data *this)
+{
+    struct stat st ;
+    if(this->fd<0) 
+    {
+        // File created (again) after we started
+        follow_open_file(this, 0) ;
+        if(this->fd<0) return ;
+    }
+    if(follow_read(this)) 
+    {
+        // Rest of the data, truncation and rotation on next wakeup
+        follow_continue(this) ;
+        return ;
+    }
+    if(fstat(this->fd, &st)==0 && (uint64_t)st.st_size<this->offset)
+    {
+        this->truncations++ ;
+        this->offset=0 ;
+        follow_send_partial(this) ;
+        if(follow_read(this))
+        {
+            follow_continue(this) ;
+            return ;
+        }
+    }
+    // Renamed or removed file is read until a new file has the name,
+    // so data still written to the old file is not lost.
+    if(stat(this->filename, &st)==0 
+       && (st.st_ino!=this->ino || st.st_dev!=this->dev))
+    {
+        this->rotations++ ;
+        follow_send_partial(this) ;
+        follow_close_file(this) ;
+        follow_open_file(this, 0) ;
+        if(this->fd>=0 && follow_read(this)) follow_continue(this) ;
+    }
+}
+
+static void follow_handler(struct dispatch_source *source)
+{
+    struct follow_data *this=(struct follow_data *)
+                             ((char *)source-offsetof(struct follow_data,
+                                                      watch)) ;
+    char events[4096] 
+        __attribute__((aligned(__alignof__(struct inotify_event)))) ;
+    int relevant=0 ;
+    ssize_t n ;
+    pthread_mutex_lock(&this->lock) ;
+    if(this->watch.fd<0)
+    {
+        pthread_mutex_unlock(&this->lock) ;
+        return ;
+    }
+    while((n=read(this->watch.fd, events, sizeof(events)))>0)
+    {
+        char *p=events ;
+        while(p<events+n)
+        {
+            struct inotify_event *ev=(struct inotify_event *)p ;
+            // Directory events of other files are ignored
+            if(ev->wd!=this->wd_dir || (ev->len>0 
+               && strcmp(ev->name, this->basename)==0)) relevant=1 ;
+            p+=sizeof(struct inotify_event)+ev->len ;
+        }
+    }
+    if(relevant) follow_poll(this) ;
+    pthread_mutex_unlock(&this->lock) ;
+}
+
+static void follow_more_handler(struct dispatch_source *source)
+{
+    struct follow_data *this=(struct follow_data *)
+                             ((char *)source-offsetof(struct follow_data,
+                                                      more)) ;
+    pthread_mutex_lock(&this->lock) ;
+    if(this->watch.fd>=0 && dispatch_expirations(source)>0) 
+    {
+        follow_poll(this) ;
+    }
+    pthread_mutex_unlock(&this->lock) ;
+}
+
+// Call with lock held.
+static void follow_stop(struct follow_data *this)
+{
+    if(this->more.fd>=0)
+    {
+        dispatch_remove(&this->more) ;
+        close(this->more.fd) ;
+        this->more.fd=-1 ;
+    }
+    if(this->watch.fd>=0)
+    {
+        dispatch_remove(&this->watch) ;
+        follow_send_partial(this) ;
+        follow_close_file(this) ;
+        close(this->watch.fd) ;
+        this->watch.fd=-1 ;
+    }
+    free(this->filename) ;
+    this->filename=NULL ;
+    free(this->partial) ;
+    this->partial=NULL ;
+    this->partial_len=0 ;
+}
+
+// Start following filename. Call with lock held.
+static void follow_start(struct follow_data *this, const char *filename, 
+                         int from_start)
+{
+    char *slash ;
+    this->filename=strdup(filename) ;
+    this->partial=malloc(this->max_line) ;
+    if(this->filename==NULL || this->partial==NULL) 
+    {
+        follow_stop(this) ;
+        return ;
+    }
+    this->watch.fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC) ;
+    if(this->watch.fd<0)
+    {
+        printf("Could not create inotify instance!\r\n") ;
+        follow_stop(this) ;
+        return ;
+    }
+    // Directory is watched for the file to be created or renamed back
+    slash=strrchr(this->filename, '/') ;
+    if(slash==NULL)
+    {
+        this->basename=this->filename ;
+        this->wd_dir=inotify_add_watch(this->watch.fd, ".", 
+                                       IN_CREATE | IN_MOVED_TO) ;
+    }
+    else
+    {
+        this->basename=slash+1 ;
+        *slash=0 ;
+        this->wd_dir=inotify_add_watch(this->watch.fd, 
+                                       slash==this->filename ? "/" : 
+                                       this->filename, 
+                                       IN_CREATE | IN_MOVED_TO) ;
+        *slash='/' ;
+    }
+    if(this->wd_dir<0) printf("Could not watch directory of %s\r\n", 
+                              filename) ;
+    this->watch.handler=follow_handler ;
+    this->more.handler=follow_more_handler ;
+    this->more.fd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+    follow_open_file(this, !from_start) ;
+    if(this->more.fd<0 || dispatch_add(&this->more)!=0 
+       || dispatch_add(&this->watch)!=0)
+    {
+        printf("Could not follow file %s\r\n", filename) ;
+        follow_stop(this) ;
+        return ;
+    }
+    if(this->fd>=0 && follow_read(this)) follow_continue(this) ;
+}
+
+void follow_class_func(struct follow_data *this, 
+                       const struct context_rmcios *context, 
+                       int id, enum function_rmcios function,
+                       enum type_rmcios paramtype,
+                       union param_rmcios returnv, 
+                       int num_params, union param_rmcios param)
+{
+    switch(function)
+    {
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "follow channel help\r\n"
+                      " create follow ch_name\r\n"
+                      " setup ch_name filename | lines(1) | from_start(0)\r\n"
+                      "               | max_line(65536)\r\n"
+                      "   #Follow file and send data appended to it to\r\n"
+                      "   #linked channels. lines=1 sends each complete\r\n"
+                      "   #line (with newline), lines=0 sends data as it\r\n"
+                      "   #is read. Lines longer than max_line bytes are\r\n"
+                      "   #sent in parts. from_start=1 sends existing\r\n"
+                      "   #contents first. Truncated file is read again\r\n"
+                      "   #from start. After rename (rotation) the new\r\n"
+                      "   #file with the same name is followed.\r\n"
+                      " setup ch_name \r\n #Stop following \r\n"
+                      " write ch_name # check file for new data now\r\n"
+                      " read ch_name\r\n"
+                      "   #offset, sent bytes, truncations and rotations\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+        this=(struct follow_data *) calloc(1, sizeof(struct follow_data)) ;
+        if(this==NULL) break ;
+        pthread_mutex_init(&this->lock, NULL) ;
+        this->fd=-1 ;
+        this->watch.fd=-1 ;
+        this->more.fd=-1 ;
+        this->wd_file=-1 ;
+        this->wd_dir=-1 ;
+        this->id=create_channel_param(context, paramtype, param, 0,
+                                      (class_rmcios)follow_class_func, 
+                                      this ) ;
+        break ;
+
+    case setup_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        follow_stop(this) ;
+        if(num_params>0)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            int from_start=0 ;
+            this->lines=1 ;
+            this->max_line=65536 ;
+            if(num_params>1) 
+            {
+                this->lines=param_to_int(context, paramtype, param, 1) ;
+            }
+            if(num_params>2)
+            {
+                from_start=param_to_int(context, paramtype, param, 2) ;
+            }
+            if(num_params>3)
+            {
+                this->max_line=param_to_int(context, paramtype, param, 3) ;
+                if(this->max_line<1) this->max_line=1 ;
+            }
+            follow_start(this, param_to_string(context, paramtype, param, 
+                                               0, namelen, namebuffer), 
+                         from_start) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case write_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        if(this->filename!=NULL) follow_poll(this) ;
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case read_rmcios:
+        if(this==NULL) break ;
+        {
+            char stats[96] ;
+            pthread_mutex_lock(&this->lock) ;
+            snprintf(stats, sizeof(stats), 
+                     "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, 
+                     this->offset, this->bytes, this->truncations, 
+                     this->rotations) ;
+            pthread_mutex_unlock(&this->lock) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        break ;
+
+    default:
+        break ;
+    }
+}
+
+///////////////////////////////////////////////////////
+// Input - records from stdin, pipe or device
+///////////////////////////////////////////////////////
+// Source is read by the event dispatcher when it is readable, in chunks 
+// of the free space in the buffer. Records ending with delimiter are sent
+// to linked channels directly from the buffer. Record that does not fit 
+// in the buffer is sent in parts.
+struct input_data
+{
+    pthread_mutex_t lock ;
+    int id ;
+    struct dispatch_source source ; // fd=-1 when not open
+    int close_fd ; // Close fd when stopped (not stdin)
+    char delimiter ;
+    char *buffer ; 
+    int size ; // Buffer size
+    int len ; // Bytes of incomplete record in buffer
+    uint64_t records ;
+    uint64_t bytes ;
+    uint64_t overlong ; // Records sent in parts
+} conin ;
+
+static void input_send(struct input_data *this, const char *data, int len)
+{
+    this->records++ ;
+    write_buffer(module_context, linked_channels(module_context, this->id),
+                 data, len, this->id) ;
+}
+
+// Send complete records of buffer and move the rest to start.
+// Call with lock held.
+static void input_split(struct input_data *this)
+{
+    char *start=this->buffer ;
+    char *end=this->buffer+this->len ;
+    char *delim ;
+    while((delim=memchr(start, this->delimiter, end-start))!=NULL)
+    {
+        input_send(this, start, delim-start) ;
+        start=delim+1 ;
+    }
+    this->len=end-start ;
+    if(this->len==this->size)
+    {
+        this->overlong++ ;
+        input_send(this, start, this->len) ;
+        this->len=0 ;
+    }
+    else if(start!=this->buffer) memmove(this->buffer, start, this->len) ;
+}
+
+// Add data to buffer and send complete records. Call with lock held.
+static void input_data_add(struct input_data *this, 
+                           const char *data, int len)
+{
+    while(len>0)
+    {
+        int n= this->size-this->len<len ? this->size-this->len : len ;
+        memcpy(this->buffer+this->len, data, n) ;
+        this->len+=n ;
+        this->bytes+=n ;
+        input_split(this) ;
+        data+=n ;
+        len-=n ;
+    }
+}
+
+// Call with lock held.
+static void input_stop(struct input_data *this)
+{
+    if(this->source.fd>=0)
+    {
+        dispatch_remove(&this->source) ;
+        if(this->close_fd) close(this->source.fd) ;
+        this->source.fd=-1 ;
+    }
+    if(this->len>0) input_send(this, this->buffer, this->len) ;
+    this->len=0 ;
+}
+
+static void input_handler(struct dispatch_source *source)
+{
+    struct input_data *this=(struct input_data *)
+                            ((char *)source-offsetof(struct input_data,
+                                                     source)) ;
+    ssize_t n ;
+    pthread_mutex_lock(&this->lock) ;
+    if(this->source.fd<0)
+    {
+        pthread_mutex_unlock(&this->lock) ;
+        return ;
+    }
+    // One read per wakeup: source stays readable while it has data, and 
+    // other sources get their turn in between.
+    n=read(this->source.fd, this->buffer+this->len, this->size-this->len) ;
+    if(n>0)
+    {
+        this->len+=n ;
+        this->bytes+=n ;
+        input_split(this) ;
+    }
+    else if(n==0 || (errno!=EAGAIN && errno!=EINTR))
+    {
+        // End of input
+        input_stop(this) ;
+    }
+    pthread_mutex_unlock(&this->lock) ;
+}
+
+// Parse delimiter. Escapes \n \r \t \0 are accepted.
+static char input_parse_delimiter(const char *s)
+{
+    if(s[0]!='\\') return s[0] ;
+    switch(s[1])
+    {
+        case 'n': return '\n' ;
+        case 'r': return '\r' ;
+        case 't': return '\t' ;
+        case '0': return 0 ;
+        default: return s[1] ;
+    }
+}
+
+// Start reading filename, "-" is stdin. Call with lock held.
+static void input_start(struct input_data *this, const char *filename, 
+                        int size)
+{
+    char *buffer=realloc(this->buffer, size) ;
+    if(buffer==NULL) return ;
+    this->buffer=buffer ;
+    this->size=size ;
+    if(strcmp(filename, "-")==0)
+    {
+        // Not made non-blocking: flag would be shared with other users of
+        // the terminal. Read is done only when stdin is readable.
+        this->source.fd=STDIN_FILENO ;
+        this->close_fd=0 ;
+    }
+    else
+    {
+        // Pipe is opened also for writing, so that it does not reach end 
+        // of input when writers come and go.
+        struct stat st ;
+        int flags= stat(filename, &st)==0 && S_ISFIFO(st.st_mode) ? 
+                   O_RDWR : O_RDONLY ;
+        this->source.fd=open(filename, flags | O_NONBLOCK | O_CLOEXEC 
+                                       | O_NOCTTY) ;
+        this->close_fd=1 ;
+        if(this->source.fd<0)
+        {
+            printf("Could not open input %s\r\n", filename) ;
+            return ;
+        }
+    }
+    this->source.handler=input_handler ;
+    if(dispatch_add(&this->source)!=0)
+    {
+        // epoll does not support regular files
+        printf("Could not poll input %s\r\n", filename) ;
+        if(this->close_fd) close(this->source.fd) ;
+        this->source.fd=-1 ;
+    }
+}
+
+static void input_data_init(struct input_data *this)
+{
+    pthread_mutex_init(&this->lock, NULL) ;
+    this->source.fd=-1 ;
+    this->delimiter='\n' ;
+}
+
+void input_class_func(struct input_data *this, 
+                      const struct context_rmcios *context, 
+                      int id, enum function_rmcios function,
+                      enum type_rmcios paramtype,
+                      union param_rmcios returnv, 
+                      int num_params, union param_rmcios param)
+{
+    switch(function)
+    {
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "input channel help\r\n"
+                      " create input ch_name\r\n"
+                      " setup ch_name filename | delimiter(\\n)\r\n"
+                      "               | buffer_size(65536)\r\n"
+                      "   #Read stdin (filename -), named pipe or\r\n"
+                      "   #character device without blocking and send\r\n"
+                      "   #records ending with delimiter to linked\r\n"
+                      "   #channels (without delimiter). Record longer\r\n"
+                      "   #than buffer_size is sent in parts.\r\n"
+                      " setup ch_name \r\n #Stop reading \r\n"
+                      " write ch_name data # handle data as input\r\n"
+                      " read ch_name\r\n"
+                      "   #records, bytes and records sent in parts\r\n"
+                      " console_in is input channel for stdin:\r\n"
+                      "   setup console_in -\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+        this=(struct input_data *) calloc(1, sizeof(struct input_data)) ;
+        if(this==NULL) break ;
+        input_data_init(this) ;
+        this->id=create_channel_param(context, paramtype, param, 0,
+                                      (class_rmcios)input_class_func, 
+                                      this ) ;
+        break ;
+
+    case setup_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        input_stop(this) ;
+        if(num_params>0)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            int size=65536 ;
+            if(num_params>1)
+            {
+                int dlen=param_string_alloc_size(context, paramtype, 
+                                                 param, 1) ;
+                char dbuffer[dlen] ;
+                this->delimiter=input_parse_delimiter(
+                    param_to_string(context, paramtype, param, 1, 
+                                    dlen, dbuffer)) ;
+            }
+            if(num_params>2)
+            {
+                size=param_to_int(context, paramtype, param, 2) ;
+                if(size<1) size=1 ;
+            }
+            input_start(this, param_to_string(context, paramtype, param, 
+                                              0, namelen, namebuffer), 
+                        size) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case write_rmcios:
+        if(this==NULL || num_params<1) break ;
+        pthread_mutex_lock(&this->lock) ;
+        if(this->buffer==NULL) ;
+        else if(paramtype==buffer_rmcios)
+        {
+            input_data_add(this, param.bv[0].data, param.bv[0].length) ;
+        }
+        else
+        {
+            int plen=param_string_alloc_size(context, paramtype, param, 0) ;
+            char buffer[plen] ;
+            const char *s=param_to_string(context, paramtype, param, 0, 
+                                          plen, buffer) ;
+            input_data_add(this, s, strlen(s)) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case read_rmcios:
+        if(this==NULL) break ;
+        {
+            char stats[96] ;
+            pthread_mutex_lock(&this->lock) ;
+            snprintf(stats, sizeof(stats), 
+                     "%" PRIu64 " %" PRIu64 " %" PRIu64, 
+                     this->records, this->bytes, this->overlong) ;
+            pthread_mutex_unlock(&this->lock) ;
+            return_string(context, paramtype, returnv, stats) ;
+        }
+        break ;
+
+    default:
+        break ;
+    }
+}
+
+///////////////////////////////////////////////////////
+// Shared memory export of latest values
+///////////////////////////////////////////////////////
+// Each shm channel publishes its latest written value in a slot named by
+// the channel in a shared memory segment. Channels of the process share 
+// segments by name. Layout and reader functions are in rmcios_shm.h.
+struct shm_segment
+{
+    char *name ; // Shared memory object name with leading /
+    struct rmcios_shm_header *header ;
+    int refs ; // Attached channels
+    struct shm_segment *next ;
+} ;
+
+static struct shm_segment *shm_segments=NULL ;
+static pthread_mutex_t shm_segments_lock=PTHREAD_MUTEX_INITIALIZER ;
+
+struct shm_data
+{
+    pthread_mutex_t lock ; 
+    char name[RMCIOS_SHM_NAME_SIZE] ; // Slot name: channel name
+    struct shm_segment *segment ; 
+    struct rmcios_shm_slot *slot ; // NULL when not attached
+} ;
+
+// Create and map new segment with num_slots slots. 
+// Call with shm_segments_lock held.
+static struct shm_segment *shm_segment_create(const char *name, 
+                                              int num_slots)
+{
+    struct shm_segment *seg=calloc(1, sizeof(struct shm_segment)) ;
+    struct rmcios_shm_header *h ;
+    uint64_t size=sizeof(struct rmcios_shm_header)
+                  +(uint64_t)num_slots*sizeof(struct rmcios_shm_slot) ;
+    int fd ;
+    if(seg==NULL) return NULL ;
+    seg->name=malloc(strlen(name)+2) ;
+    if(seg->name==NULL)
+    {
+        free(seg) ;
+        return NULL ;
+    }
+    seg->name[0]='/' ;
+    strcpy(seg->name+1, name) ;
+    fd=shm_open(seg->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644) ;
+    if(fd<0 && errno==EEXIST)
+    {
+        // Left by a stopped process or used by a running one
+        const struct rmcios_shm_header *old=rmcios_shm_attach(name) ;
+        int tries ;
+        for(tries=0 ; old==NULL && tries<10 ; tries++)
+        {
+            // May be just created by other process
+            struct timespec ts={0, 1000000} ;
+            nanosleep(&ts, NULL) ;
+            old=rmcios_shm_attach(name) ;
+        }
+        if(old!=NULL && rmcios_shm_owner_alive(old))
+        {
+            printf("Shared memory %s is used by process %d\r\n", 
+                   seg->name, (int)old->owner_pid) ;
+            rmcios_shm_detach(old) ;
+            free(seg->name) ;
+            free(seg) ;
+            return NULL ;
+        }
+        rmcios_shm_detach(old) ;
+        // Old contents are not trusted: segment is created again
+        shm_unlink(seg->name) ;
+        fd=shm_open(seg->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if(fd<0 || ftruncate(fd, size)!=0)
+    {
+        printf("Could not create shared memory %s\r\n", seg->name) ;
+        if(fd>=0) 
+        {
+            close(fd) ;
+            shm_unlink(seg->name) ;
+        }
+        free(seg->name) ;
+        free(seg) ;
+        return NULL ;
+    }
+    h=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+    close(fd) ;
+    if(h==MAP_FAILED)
+    {
+        printf("Could not map shared memory %s\r\n", seg->name) ;
+        shm_unlink(seg->name) ;
+        free(seg->name) ;
+        free(seg) ;
+        return NULL ;
+    }
+    h->version=RMCIOS_SHM_VERSION ;
+    h->slot_size=sizeof(struct rmcios_shm_slot) ;
+    h->num_slots=num_slots ;
+    h->used_slots=0 ;
+    h->size=size ;
+    h->generation=clock_ns(CLOCK_REALTIME)^((uint64_t)getpid()<<32) ;
+    h->owner_pid=getpid() ;
+    // Magic last: readers check it first 
+    __atomic_thread_fence(__ATOMIC_RELEASE) ;
+    memcpy(h->magic, RMCIOS_SHM_MAGIC, sizeof(h->magic)) ;
+    seg->header=h ;
+    seg->next=shm_segments ;
+    shm_segments=seg ;
+    return seg ;
+}
+
+// Attach channel to slot in segment. Segment is created with num_slots 
+// slots when not already used by the process. Call with channel lock held.
+static void shm_attach(struct shm_data *this, const char *name, 
+                       int num_slots)
+{
+    struct shm_segment *seg ;
+    struct rmcios_shm_header *h ;
+    uint32_t i ;
+    pthread_mutex_lock(&shm_segments_lock) ;
+    for(seg=shm_segments ; seg!=NULL ; seg=seg->next)
+    {
+        if(strcmp(seg->name+1, name)==0) break ;
+    }
+    if(seg==NULL) seg=shm_segment_create(name, num_slots) ;
+    if(seg==NULL)
+    {
+        pthread_mutex_unlock(&shm_segments_lock) ;
+        return ;
+    }
+    h=seg->header ;
+    // Slot of the same name is reused
+    for(i=0 ; i<h->used_slots ; i++)
+    {
+        if(strcmp(rmcios_shm_slots(h)[i].name, this->name)==0) break ;
+    }
+    if(i==h->used_slots)
+    {
+        if(i==h->num_slots)
+        {
+            printf("No free slot for %s in shared memory %s\r\n", 
+                   this->name, seg->name) ;
+            seg=NULL ;
+        }
+        else 
+        {
+            memcpy(rmcios_shm_slots(h)[i].name, this->name, 
+                   sizeof(this->name)) ;
+            __atomic_store_n(&h->used_slots, i+1, __ATOMIC_RELEASE) ;
+        }
+    }
+    if(seg!=NULL)
+    {
+        seg->refs++ ;
+        this->segment=seg ;
+        this->slot=rmcios_shm_slots(h)+i ;
+    }
+    pthread_mutex_unlock(&shm_segments_lock) ;
+}
+
+// Detach channel. Last channel removes the segment. 
+// Call with channel lock held.
+static void shm_detach(struct shm_data *this)
+{
+    struct shm_segment **p ;
+    if(this->segment==NULL) return ;
+    pthread_mutex_lock(&shm_segments_lock) ;
+    if(--this->segment->refs==0)
+    {
+        for(p=&shm_segments ; *p!=this->segment ; p=&(*p)->next) ;
+        *p=this->segment->next ;
+        // Readers see that the segment is stale
+        __atomic_store_n(&this->segment->header->owner_pid, 0, 
+                         __ATOMIC_RELEASE) ;
+        shm_unlink(this->segment->name) ;
+        munmap(this->segment->header, this->segment->header->size) ;
+        free(this->segment->name) ;
+        free(this->segment) ;
+    }
+    pthread_mutex_unlock(&shm_segments_lock) ;
+    this->segment=NULL ;
+    this->slot=NULL ;
+}
+
+// Convert written parameters to slot value.
+static void shm_value(const struct context_rmcios *context, 
+                      enum type_rmcios paramtype, int num_params, 
+                      union param_rmcios param, struct rmcios_shm_value *v)
+{
+    int i, max=RMCIOS_SHM_VALUE_SIZE/sizeof(int64_t) ;
+    struct timespec ts ;
+    clock_gettime(CLOCK_REALTIME, &ts) ;
+    v->timestamp_ns=(int64_t)ts.tv_sec*1000000000+ts.tv_nsec ;
+    if(num_params>max) num_params=max ;
+    if(paramtype==int_rmcios)
+    {
+        v->type=RMCIOS_SHM_INT ;
+        v->length=num_params ;
+        for(i=0 ; i<num_params ; i++) v->i[i]=param.iv[i] ;
+    }
+    else if(paramtype==float_rmcios)
+    {
+        v->type=RMCIOS_SHM_FLOAT ;
+        v->length=num_params ;
+        for(i=0 ; i<num_params ; i++) v->f[i]=param.fv[i] ;
+    }
+    else
+    {
+        // Text that is a number is published as number 
+        char buffer[RMCIOS_SHM_VALUE_SIZE+1] ;
+        char *end ;
+        const char *s=param_to_string(context, paramtype, param, 0, 
+                                      sizeof(buffer), buffer) ;
+        double f=strtod(s, &end) ;
+        if(end!=s && *end==0)
+        {
+            v->type=RMCIOS_SHM_FLOAT ;
+            v->length=1 ;
+            v->f[0]=f ;
+        }
+        else
+        {
+            v->type=RMCIOS_SHM_STRING ;
+            v->length=strlen(s) ;
+            memcpy(v->s, s, v->length) ;
+        }
+    }
+}
+
+void shm_class_func(struct shm_data *this, 
+                    const struct context_rmcios *context, 
+                    int id, enum function_rmcios function,
+                    enum type_rmcios paramtype,
+                    union param_rmcios returnv, 
+                    int num_params, union param_rmcios param)
+{
+    switch(function)
+    {
+    case help_rmcios:
+        return_string(context,paramtype,returnv,
+                      "shm channel help\r\n"
+                      " create shm ch_name\r\n"
+                      " setup ch_name segment | slots(64)\r\n"
+                      "   #Publish latest value written to the channel\r\n"
+                      "   #in slot ch_name of shared memory segment\r\n"
+                      "   #/dev/shm/segment. Segment is created with\r\n"
+                      "   #slots slots by the first channel using it.\r\n"
+                      "   #Segment of a running process is not taken\r\n"
+                      "   #over. Readers use rmcios_shm.h.\r\n"
+                      " setup ch_name \r\n"
+                      "   #Stop publishing. Segment is removed when no\r\n"
+                      "   #channel uses it.\r\n"
+                      " write ch_name value\r\n"
+                      "   #Publish value: up to 8 ints or floats, or\r\n"
+                      "   #string of up to 64 bytes\r\n"
+                      " read ch_name # latest published value\r\n"
+                      );
+        break ;
+
+    case create_rmcios:
+        if(num_params<1) break ;
+        this=(struct shm_data *) calloc(1, sizeof(struct shm_data)) ;
+        if(this==NULL) break ;
+        pthread_mutex_init(&this->lock, NULL) ;
+        param_to_string(context, paramtype, param, 0, 
+                        sizeof(this->name), this->name) ;
+        create_channel_param(context, paramtype, param, 0,
+                             (class_rmcios)shm_class_func, this ) ;
         break ;
 
     case setup_rmcios:
         if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        shm_detach(this) ;
+        if(num_params>0)
+        {
+            int namelen=param_string_alloc_size(context, paramtype,param,0) ; 
+            char namebuffer[namelen] ;
+            int slots=64 ;
+            if(num_params>1) slots=param_to_int(context, paramtype, param, 1);
+            if(slots<1) slots=1 ;
+            shm_attach(this, param_to_string(context, paramtype, param, 0,
+                                             namelen, namebuffer), 
+                       slots) ;
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    case write_rmcios:
+        if(this==NULL || num_params<1) break ;
+        {
+            struct rmcios_shm_value v ;
+            memset(&v, 0, sizeof(v)) ;
+            shm_value(context, paramtype, num_params, param, &v) ;
+            pthread_mutex_lock(&this->lock) ;
+            if(this->slot!=NULL) rmcios_shm_write(this->slot, &v) ;
+            pthread_mutex_unlock(&this->lock) ;
+        }
+        break ;
+
+    case read_rmcios:
+        if(this==NULL) break ;
+        pthread_mutex_lock(&this->lock) ;
+        if(this->slot!=NULL)
+        {
+            struct rmcios_shm_value *v=&this->slot->value ;
+            if(v->type==RMCIOS_SHM_INT) 
+            {
+                return_int(context, paramtype, returnv, v->i[0]) ;
+            }
+            else if(v->type==RMCIOS_SHM_FLOAT) 
+            {
+                return_float(context, paramtype, returnv, v->f[0]) ;
+            }
+            else if(v->type==RMCIOS_SHM_STRING)
+            {
+                return_buffer(context, paramtype, returnv, v->s, v->length);
+            }
+        }
+        pthread_mutex_unlock(&this->lock) ;
+        break ;
+
+    default:
+        break ;
+    }
+}
+
+/////////////////////////////////////////////////////
+// Execution profiler
+/////////////////////////////////////////////////////
+// Histogram of nanosecond durations with log2 buckets.
+// Bucket i counts durations in range [2^(i-1), 2^i).
+#define HISTOGRAM_BUCKETS 40
+struct histogram
+{
+    uint64_t count[HISTOGRAM_BUCKETS] ;
+    uint64_t max ;
+} ;
+
+static void histogram_add(struct histogram *h, uint64_t ns)
+{
+    int bucket= ns ? 64-__builtin_clzll(ns) : 0 ;
+    if(bucket>=HISTOGRAM_BUCKETS) bucket=HISTOGRAM_BUCKETS-1 ;
+    __atomic_fetch_add(&h->count[bucket], 1, __ATOMIC_RELAXED) ;
+    if(ns>__atomic_load_n(&h->max, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED) ;
+    }
+}
+
+// Upper limit of bucket that contains the percentile.
+static uint64_t histogram_percentile(struct histogram *h, int percent)
+{
+    uint64_t total=0, sum=0, max ;
+    int i ;
+    for(i=0 ; i<HISTOGRAM_BUCKETS ; i++)
+    {
+        total+=__atomic_load_n(&h->count[i], __ATOMIC_RELAXED) ;
+    }
+    if(total==0) return 0 ;
+    for(i=0 ; i<HISTOGRAM_BUCKETS-1 ; i++)
+    {
+        sum+=__atomic_load_n(&h->count[i], __ATOMIC_RELAXED) ;
+        if(sum*100>=total*percent) break ;
+    }
+    max=__atomic_load_n(&h->max, __ATOMIC_RELAXED) ;
+    if(i==HISTOGRAM_BUCKETS-1 || (1ull<<i)-(i>0)>max) return max ;
+    return (1ull<<i)-(i>0) ;
+}
+
+// Print bucket counts separated by spaces. Trailing empty buckets omitted.
+static void histogram_print(struct histogram *h, char *buffer, int size)
+{
+    int i, last=0, len=0 ;
+    buffer[0]=0 ;
+    for(i=0 ; i<HISTOGRAM_BUCKETS ; i++)
+    {
+        if(__atomic_load_n(&h->count[i], __ATOMIC_RELAXED)) last=i ;
+    }
+    for(i=0 ; i<=last && len<size ; i++)
+    {
+        len+=snprintf(buffer+len, size-len, i ? " %" PRIu64 : "%" PRIu64,
+                      __atomic_load_n(&h->count[i], __ATOMIC_RELAXED)) ;
+    }
+}
+
+// Execution times of channels run by timers. Open addressing table keyed 
+// by channel id and kind, entries are never removed while enabled.
+// Enabling switches to the other of two static tables. Tables are never
+// freed, so a recorder holding the old table does no harm. The other 
+// table is cleared only after its last user has left.
+#define PROFILE_ENTRIES 256
+#define PROFILE_CHAIN 0 // All channels linked to timer, by timer id
+#define PROFILE_RUN 1 // One executed channel, by its id 
+struct profile_entry
+{
+    int key ; // id*2+kind+1, 0=free entry
+    uint64_t calls ;
+    uint64_t total ; // ns
+    uint64_t min ; // ns
+    struct histogram time ;
+} ;
+
+struct profile_table
+{
+    int users ; // Recorders and readers using the table
+    struct profile_entry entry[PROFILE_ENTRIES] ;
+} ;
+
+static struct profile_table profile_tables[2] ;
+static int profile_current=-1 ; // Index of table in use, -1=none yet
+static pthread_mutex_t profile_reset_lock=PTHREAD_MUTEX_INITIALIZER ;
+static int profile_enabled=0 ;
+
+// Context given to profiled channels. Same as module context but calls 
+// to channels are timed per channel id.
+static struct context_rmcios profile_context ;
+
+// Start time of profiled call. 0 when profiling is disabled.
+static inline uint64_t profile_begin(void)
+{
+    if(!__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) return 0 ;
+    return clock_ns(CLOCK_MONOTONIC) ;
+}
+
+// Get current table for use. Returns NULL when there is none.
+static struct profile_table *profile_table_get(void)
+{
+    struct profile_table *table ;
+    int current=__atomic_load_n(&profile_current, __ATOMIC_SEQ_CST) ;
+    if(current<0) return NULL ;
+    table=&profile_tables[current] ;
+    __atomic_fetch_add(&table->users, 1, __ATOMIC_SEQ_CST) ;
+    if(__atomic_load_n(&profile_current, __ATOMIC_SEQ_CST)!=current)
+    {
+        // Switched meanwhile: the table may be being cleared
+        __atomic_fetch_sub(&table->users, 1, __ATOMIC_RELEASE) ;
+        return NULL ;
+    }
+    return table ;
+}
+
+static void profile_table_put(struct profile_table *table)
+{
+    __atomic_fetch_sub(&table->users, 1, __ATOMIC_RELEASE) ;
+}
+
+static void profile_end(int id, int kind, uint64_t start)
+{
+    struct profile_table *table ;
+    uint64_t elapsed ;
+    unsigned int i, n ;
+    int key=id*2+kind+1 ;
+    if(start==0) return ;
+    elapsed=clock_ns(CLOCK_MONOTONIC)-start ;
+    table=profile_table_get() ;
+    if(table==NULL) return ;
+
+    for(n=0, i=(unsigned int)key*2654435761u ; n<PROFILE_ENTRIES ; n++, i++)
+    {
+        struct profile_entry *e=&table->entry[i%PROFILE_ENTRIES] ;
+        int entry_key=__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) ;
+        if(entry_key==0)
+        {
+            // Claim free entry
+            if(!__atomic_compare_exchange_n(&e->key, &entry_key, key, 0, 
+                                            __ATOMIC_ACQ_REL, 
+                                            __ATOMIC_ACQUIRE)
+               && entry_key!=key) continue ;
+            entry_key=key ;
+        }
+        if(entry_key!=key) continue ;
+
+        __atomic_fetch_add(&e->calls, 1, __ATOMIC_RELAXED) ;
+        __atomic_fetch_add(&e->total, elapsed, __ATOMIC_RELAXED) ;
+        if(elapsed<__atomic_load_n(&e->min, __ATOMIC_RELAXED) 
+           || __atomic_load_n(&e->calls, __ATOMIC_RELAXED)==1)
+        {
+            __atomic_store_n(&e->min, elapsed, __ATOMIC_RELAXED) ;
+        }
+        histogram_add(&e->time, elapsed) ;
+        break ;
+    }
+    profile_table_put(table) ;
+}
+
+// run_channel of profile_context. Times call of channel id.
+static void profile_run_channel(const struct context_rmcios *context, 
+                                int id, enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                union param_rmcios returnv,
+                                int num_params, union param_rmcios param)
+{
+    uint64_t start=profile_begin() ;
+    (void)context ;
+    module_context->run_channel(&profile_context, id, function, paramtype,
+                                returnv, num_params, param) ;
+    profile_end(id, PROFILE_RUN, start) ;
+}
+
+// Run linked channels of channel id with write. When profiling, the 
+// whole run is timed by id, and the linked channels are run with 
+// profile_context so each executed channel is timed by its own id.
+static void profile_run_linked(int id)
+{
+    uint64_t start=profile_begin() ;
+    const struct context_rmcios *context= start ? &profile_context 
+                                                : module_context ;
+    module_context->run_channel(context, 
+                                linked_channels(module_context, id),
+                                write_rmcios, int_rmcios,
+                                (union param_rmcios)0,
+                                0,(union param_rmcios)0) ;
+    profile_end(id, PROFILE_CHAIN, start) ;
+}
+
+// Write to channel id. Timed by id when profiling.
+static void profile_run(int id)
+{
+    const struct context_rmcios *context= 
+        __atomic_load_n(&profile_enabled, __ATOMIC_RELAXED) ? 
+        &profile_context : module_context ;
+    context->run_channel(context, id, write_rmcios, int_rmcios,
+                         (union param_rmcios)0, 0, (union param_rmcios)0) ;
+}
+
+// Print profiling results as lines of: 
+// channel kind calls min_ns mean_ns p99_ns max_ns
+static int profile_report(char *buffer, int size)
+{
+    struct profile_table *table=profile_table_get() ;
+    int i, len ;
+    len=snprintf(buffer, size, 
+                 "channel kind calls min_ns mean_ns p99_ns max_ns\n") ;
+    for(i=0 ; i<PROFILE_ENTRIES && table!=NULL && len<size ; i++)
+    {
+        struct profile_entry *e=&table->entry[i] ;
+        uint64_t calls=__atomic_load_n(&e->calls, __ATOMIC_RELAXED) ;
+        int key=__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) ;
+        if(key==0 || calls==0) continue ;
+        key-- ;
+        len+=snprintf(buffer+len, size-len, 
+                      "%d %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 
+                      " %" PRIu64 "\n", 
+                      key/2, key%2==PROFILE_CHAIN ? "chain" : "run", calls, 
+                      __atomic_load_n(&e->min, __ATOMIC_RELAXED),
+                      __atomic_load_n(&e->total, __ATOMIC_RELAXED)/calls,
+                      histogram_percentile(&e->time, 99),
+                      __atomic_load_n(&e->time.max, __ATOMIC_RELAXED)) ;
+    }
+    if(table!=NULL) profile_table_put(table) ;
+    return len<size ? len : size-1 ;
+}
+
+void profiler_class_func(void *data, 
+                         const struct context_rmcios *context, 
+                         int id, enum function_rmcios function,
+                         enum type_rmcios paramtype,
+                         union param_rmcios returnv, 
+                         int num_params, union param_rmcios param)
+{
+ switch(function)
+ {
+     case help_rmcios:
+         return_string(context,paramtype,returnv,
+                 "profiler channel help\r\n"
+                 "Execution times of channels linked to timers\r\n"
+                 " create profiler newname\r\n"
+                 "   #Channel for the same results with own links\r\n"
+                 " setup profiler enabled(1/0)\r\n"
+                 "   #Enabling clears previous results\r\n"
+                 " read profiler\r\n"
+                 "   #Get results. One line for each channel id:\r\n"
+                 "   #channel kind calls min_ns mean_ns p99_ns max_ns\r\n"
+                 "   #kind chain: all channels linked to timer channel\r\n"
+                 "   #kind run: one channel run by timer, or by a\r\n"
+                 "   #          channel run by timer\r\n"
+                 " write profiler\r\n"
+                 "   #Send results to linked channel\r\n"
+                 " link profiler file_channel\r\n"
+                 ) ;
+         break ;
+
+     case create_rmcios:
+         if(num_params<1) break ;
+         create_channel_param(context, paramtype, param, 0, 
+                              (class_rmcios)profiler_class_func, NULL) ;
+         break ;
+
+     case setup_rmcios:
+         if(num_params<1) break ;
+         if(param_to_int(context, paramtype, param, 0)!=0)
+         {
+             struct profile_table *table ;
+             int next ;
+             pthread_mutex_lock(&profile_reset_lock) ;
+             next= profile_current==0 ? 1 : 0 ;
+             table=&profile_tables[next] ;
+             // Users of the table from before the previous switch leave, 
+             // new ones back off until the switch below.
+             while(__atomic_load_n(&table->users, __ATOMIC_ACQUIRE)!=0) 
+             {
+                 sched_yield() ;
+             }
+             memset(table->entry, 0, sizeof(table->entry)) ;
+             __atomic_store_n(&profile_current, next, __ATOMIC_SEQ_CST) ;
+             pthread_mutex_unlock(&profile_reset_lock) ;
+             __atomic_store_n(&profile_enabled, 1, __ATOMIC_SEQ_CST) ;
+         }
+         else __atomic_store_n(&profile_enabled, 0, __ATOMIC_SEQ_CST) ;
+         break ;
+
+     case read_rmcios:
+     case write_rmcios:
+         {
+             int size=64*(PROFILE_ENTRIES+1) ;
+             char *buffer=malloc(size) ;
+             if(buffer==NULL) break ;
+             profile_report(buffer, size) ;
+             if(function==write_rmcios)
+             {
+                 write_str(context, linked_channels(context, id), buffer, id);
+             }
+             return_string(context, paramtype, returnv, buffer) ;
+             free(buffer) ;
+         }
+         break ;
+
+     default:
+         break ;
+ }
+}
+
+/////////////////////////////////////////////////////
+// Timer executor
+/////////////////////////////////////////////////////
+// Optional pool of worker threads that run the linked channels of fired 
+// timers. Each worker has a bounded queue and steals from the queues of 
+// other workers when its own is empty. Without workers jobs are run 
+// directly in the dispatcher thread.
+struct executor_job
+{
+    void (*run)(struct executor_job *job) ;
+    int serial ; // Runs of the job must not overlap
+    int pending ; // Runs queued or running of a serial job
+} ;
+
+struct executor_queue
+{
+    pthread_mutex_t lock ;
+    struct executor_job **jobs ;
+    int size ;
+    int first ;
+    int len ;
+} ;
+
+// Pool of workers. Replaced as a whole when reconfigured.
+struct executor_pool
+{
+    int num_workers ; // Queues
+    struct executor_queue *queues ;
+    pthread_t *threads ;
+    int started ; // Worker threads, each with own queue
+    pthread_mutex_t lock ; // For sleeping workers
+    pthread_cond_t cond ;
+    int idle ;
+    int stop ;
+} ;
+
+static struct 
+{
+    pthread_rwlock_t config_lock ; // Held for writing when pool is changed
+    struct executor_pool *pool ; // NULL when there are no workers
+    unsigned int next ; // Queue for next submit
+    uint64_t inline_runs ; // Jobs run in dispatcher because queues were full
+} executor={PTHREAD_RWLOCK_INITIALIZER, NULL, 0, 0} ;
+
+// Pool of the calling worker thread, NULL in other threads.
+static __thread struct executor_pool *executor_current_pool=NULL ;
+
+// Run job until no runs are pending.
+static void executor_run(struct executor_job *job)
+{
+    if(!job->serial) 
+    {
+        job->run(job) ;
+        return ;
+    }
+    do
+    {
+        job->run(job) ;
+    } while(__atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL)>0) ;
+}
+
+static int executor_push(struct executor_queue *q, struct executor_job *job)
+{
+    int ok=0 ;
+    pthread_mutex_lock(&q->lock) ;
+    if(q->len<q->size)
+    {
+        q->jobs[(q->first+q->len++)%q->size]=job ;
+        ok=1 ;
+    }
+    pthread_mutex_unlock(&q->lock) ;
+    return ok ;
+}
+
+// Take job from front of own queue or from back of another queue.
+static struct executor_job *executor_pop(struct executor_queue *q, int steal)
+{
+    struct executor_job *job=NULL ;
+    pthread_mutex_lock(&q->lock) ;
+    if(q->len>0)
+    {
+        if(steal) job=q->jobs[(q->first+--q->len)%q->size] ;
+        else 
+        {
+            job=q->jobs[q->first] ;
+            q->first=(q->first+1)%q->size ;
+            q->len-- ;
+        }
+    }
+    pthread_mutex_unlock(&q->lock) ;
+    return job ;
+}
+
+static struct executor_job *executor_take(struct executor_pool *pool, 
+                                          int worker)
+{
+    struct executor_job *job=executor_pop(&pool->queues[worker], 0) ;
+    int i ;
+    for(i=1 ; job==NULL && i<pool->num_workers ; i++)
+    {
+        job=executor_pop(&pool->queues[(worker+i)%pool->num_workers], 1) ;
+    }
+    return job ;
+}
+
+// Argument of worker thread
+struct executor_worker_arg
+{
+    struct executor_pool *pool ;
+    int worker ;
+} ;
+
+static void *executor_worker(void *data)
+{
+    struct executor_worker_arg *arg=data ;
+    struct executor_pool *pool=arg->pool ;
+    int worker=arg->worker ;
+    free(arg) ;
+    executor_current_pool=pool ;
+    dispatch_thread_configure(pthread_self()) ;
+    if(dispatch_sched.locked) dispatch_stack_prefault() ;
+    for(;;)
+    {
+        struct executor_job *job=executor_take(pool, worker) ;
+        if(job!=NULL)
+        {
+            executor_run(job) ;
+            continue ;
+        }
+        pthread_mutex_lock(&pool->lock) ;
+        pool->idle++ ;
+        job=executor_take(pool, worker) ;
+        if(job==NULL && pool->stop) 
+        {
+            pool->idle-- ;
+            pthread_mutex_unlock(&pool->lock) ;
+            break ;
+        }
+        if(job==NULL) pthread_cond_wait(&pool->cond, &pool->lock) ;
+        pool->idle-- ;
+        pthread_mutex_unlock(&pool->lock) ;
+        if(job!=NULL) executor_run(job) ;
+    }
+    return NULL ;
+}
+
+// Run job in worker pool, or in calling thread when there is no pool.
+static void executor_submit(struct executor_job *job)
+{
+    struct executor_pool *pool ;
+    int i ;
+    if(job->serial 
+       && __atomic_fetch_add(&job->pending, 1, __ATOMIC_ACQ_REL)>0) 
+    {
+        return ; // Running worker runs it again
+    }
+    pthread_rwlock_rdlock(&executor.config_lock) ;
+    pool=executor.pool ;
+    for(i=0 ; pool!=NULL && i<pool->num_workers ; i++)
+    {
+        unsigned int next=__atomic_fetch_add(&executor.next, 1, 
+                                             __ATOMIC_RELAXED) ;
+        if(executor_push(&pool->queues[next%pool->num_workers], job)) 
+        {
+            break ;
+        }
+    }
+    if(pool==NULL || i==pool->num_workers) 
+    {
+        // No workers or all queues full
+        pthread_rwlock_unlock(&executor.config_lock) ;
+        if(pool!=NULL) 
+        {
+            __atomic_fetch_add(&executor.inline_runs, 1, __ATOMIC_RELAXED) ;
+        }
+        executor_run(job) ;
+        return ;
+    }
+    pthread_mutex_lock(&pool->lock) ;
+    if(pool->idle>0) pthread_cond_signal(&pool->cond) ;
+    pthread_mutex_unlock(&pool->lock) ;
+    pthread_rwlock_unlock(&executor.config_lock) ;
+}
+
+// Stop workers of pool after its queued jobs have been run, and free it.
+// Call without config_lock. Pool must not be executor.pool any more.
+static void executor_stop(struct executor_pool *pool)
+{
+    int i ;
+    if(pool==NULL) return ;
+    pthread_mutex_lock(&pool->lock) ;
+    pool->stop=1 ;
+    pthread_cond_broadcast(&pool->cond) ;
+    pthread_mutex_unlock(&pool->lock) ;
+    for(i=0 ; i<pool->started ; i++) 
+    {
+        pthread_join(pool->threads[i], NULL) ;
+    }
+    for(i=0 ; i<pool->num_workers ; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock) ;
+        free(pool->queues[i].jobs) ;
+    }
+    pthread_mutex_destroy(&pool->lock) ;
+    pthread_cond_destroy(&pool->cond) ;
+    free(pool->queues) ;
+    free(pool->threads) ;
+    free(pool) ;
+}
+
+// Start pool of num_workers threads with total queue size of queue_size.
+// Returns NULL when no worker could be started.
+static struct executor_pool *executor_start(int num_workers, int queue_size)
+{
+    struct executor_pool *pool ;
+    int i ;
+    if(num_workers<=0) return NULL ;
+    if(queue_size<num_workers) queue_size=num_workers ;
+    pool=calloc(1, sizeof(struct executor_pool)) ;
+    if(pool==NULL) return NULL ;
+    pool->queues=calloc(num_workers, sizeof(struct executor_queue)) ;
+    pool->threads=calloc(num_workers, sizeof(pthread_t)) ;
+    if(pool->queues==NULL || pool->threads==NULL)
+    {
+        free(pool->queues) ;
+        free(pool->threads) ;
+        free(pool) ;
+        return NULL ;
+    }
+    pthread_mutex_init(&pool->lock, NULL) ;
+    pthread_cond_init(&pool->cond, NULL) ;
+    for(i=0 ; i<num_workers ; i++)
+    {
+        struct executor_queue *q=&pool->queues[i] ;
+        pthread_mutex_init(&q->lock, NULL) ;
+        q->size=queue_size/num_workers ;
+        q->jobs=malloc(q->size*sizeof(struct executor_job *)) ;
+        if(q->jobs==NULL) q->size=0 ;
+    }
+    pool->num_workers=num_workers ;
+    // Queues without own worker are emptied by stealing
+    for(i=0 ; i<num_workers ; i++)
+    {
+        struct executor_worker_arg *arg=malloc(sizeof(*arg)) ;
+        if(arg==NULL) break ;
+        arg->pool=pool ;
+        arg->worker=i ;
+        if(pthread_create(&pool->threads[i], NULL, executor_worker, arg)!=0)
+        {
+            free(arg) ;
+            break ;
+        }
+        pool->started++ ;
+    }
+    if(pool->started<num_workers) 
+    {
+        printf("Could only start %d timer worker threads\r\n", 
+               pool->started) ;
+    }
+    if(pool->started==0)
+    {
+        executor_stop(pool) ;
+        return NULL ;
+    }
+    return pool ;
+}
+
+/////////////////////////////////////////////////////
+// Timer channel
+/////////////////////////////////////////////////////
+
+// Firing statistics of a timer
+struct timer_stats
+{
+    uint64_t fires ;
+    uint64_t overruns ; // Fires later than one period
+    uint64_t missed ; // Periods that did not fire
+    struct histogram latency ; // Actual - scheduled fire time 
+} ;
+
+static void timer_stats_record(struct timer_stats *stats, 
+                               uint64_t latency, uint64_t missed)
+{
+    __atomic_fetch_add(&stats->fires, 1, __ATOMIC_RELAXED) ;
+    if(missed>0)
+    {
+        __atomic_fetch_add(&stats->overruns, 1, __ATOMIC_RELAXED) ;
+        __atomic_fetch_add(&stats->missed, missed, __ATOMIC_RELAXED) ;
+    }
+    histogram_add(&stats->latency, latency) ;
+}
+
+// Return statistics for read ch_name stats|histogram 
+// Returns 0 when parameter is not a statistics request.
+static int timer_stats_read(struct timer_stats *stats,
+                            const struct context_rmcios *context, 
+                            int paramtype, union param_rmcios returnv, 
+                            int num_params, union param_rmcios param)
+{
+    char buffer[HISTOGRAM_BUCKETS*21] ;
+    if(num_params<1) return 0 ;
+    if(param_is_keyword(context, paramtype, param, 0, "stats"))
+    {
+        snprintf(buffer, sizeof(buffer), 
+                 "fires=%" PRIu64 " overruns=%" PRIu64 " missed=%" PRIu64 
+                 " p50=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64,
+                 __atomic_load_n(&stats->fires, __ATOMIC_RELAXED),
+                 __atomic_load_n(&stats->overruns, __ATOMIC_RELAXED),
+                 __atomic_load_n(&stats->missed, __ATOMIC_RELAXED),
+                 histogram_percentile(&stats->latency, 50),
+                 histogram_percentile(&stats->latency, 99),
+                 __atomic_load_n(&stats->latency.max, __ATOMIC_RELAXED)) ;
+    }
+    else if(param_is_keyword(context, paramtype, param, 0, "histogram"))
+    {
+        histogram_print(&stats->latency, buffer, sizeof(buffer)) ;
+    }
+    else return 0 ;
+    return_string(context, paramtype, returnv, buffer) ;
+    return 1 ;
+}
+
+struct timer_group ;
+
+struct timer_data
+{
+    struct timer_group *group ; // Shared kernel timer, NULL when stopped
+    int group_index ;
+    struct executor_job job ; // Runs linked channels
+    int completion_pending ; // Run completion channel after linked
+    float period ;
+    unsigned int loops ; 
+    int index ; 
+    int completion_channel ;
+    int id ;
+    uint64_t period_ns ;
+    uint64_t slack_ns ; // Deadline may be delayed this much to share timer
+    uint64_t deadline ; // Next scheduled expiration (CLOCK_MONOTONIC ns)
+    struct timer_stats stats ;
+} ;
+
+// Timers with the same period and phase share one timerfd. Expiration 
+// of the group fires all members. Groups are not freed; empty groups are
+// disarmed and reused.
+struct timer_group
+{
+    struct dispatch_source source ; // timerfd
+    struct timer_group *next ;
+    uint64_t period_ns ;
+    uint64_t deadline ; // Next expiration (CLOCK_MONOTONIC ns)
+    struct timer_data **members ;
+    int len ;
+    int size ;
+    struct timer_data **fired ; // Only used by dispatcher thread
+    int fired_size ;
+} ;
+
+static struct timer_group *timer_groups=NULL ;
+static pthread_mutex_t timer_groups_lock=PTHREAD_MUTEX_INITIALIZER ;
+
+// Remove timer from its group. Call with timer_groups_lock held.
+static void timer_group_leave(struct timer_data *this)
+{
+    struct timer_group *group=this->group ;
+    if(group==NULL) return ;
+    group->members[this->group_index]=group->members[--group->len] ;
+    group->members[this->group_index]->group_index=this->group_index ;
+    this->group=NULL ;
+    if(group->len==0)
+    {
+        struct itimerspec its={{0, 0}, {0, 0}} ;
+        timerfd_settime(group->source.fd, 0, &its, 0) ; // Disarm
+    }
+}
+
+static void timer_group_handler(struct dispatch_source *source)
+{
+    struct timer_group *group=(struct timer_group*) source ;
+    uint64_t expirations=dispatch_expirations(source) ;
+    uint64_t now=clock_ns(CLOCK_MONOTONIC) ;
+    int i, n=0 ;
+    if(expirations==0) return ;
 
-        // Close the file if it exist:
-        if(this->f!=NULL) 
-        {   
-            fclose(this->f) ;
-            this->f=NULL ;
+    pthread_mutex_lock(&timer_groups_lock) ;
+    if(group->len==0 || now<group->deadline) 
+    {
+        // Disarmed or rearmed after the expiration was read
+        pthread_mutex_unlock(&timer_groups_lock) ;
+        return ;
+    }
+    if(group->fired_size<group->len)
+    {
+        struct timer_data **fired=realloc(group->fired, 
+                                   group->len*sizeof(struct timer_data *)) ;
+        if(fired!=NULL)
+        {
+            group->fired=fired ;
+            group->fired_size=group->len ;
         }
-
-        if(num_params>0)
+    }
+    // Latency from the latest expiration:
+    group->deadline+=(expirations-1)*group->period_ns ;
+    for(i=group->len-1 ; i>=0 && n<group->fired_size ; i--)
+    {
+        struct timer_data *this=group->members[i] ;
+        if(this->deadline>group->deadline) continue ; // Joined, not due yet
+        timer_stats_record(&this->stats, 
+                           now>group->deadline ? now-group->deadline : 0,
+                           (group->deadline-this->deadline)/group->period_ns);
+        this->deadline=group->deadline+group->period_ns ;
+        if(this->loops>0)
         {
-            int namelen=param_string_length(context, paramtype,param,0) ; 
+            this->index++ ;
+            if((unsigned int)this->index >= this->loops ) // Stop timer
             {
-                char dirname[namelen+1] ;
-                int i ;
-                param_to_string(context, paramtype,param,0, 
-                                namelen+1, dirname) ;
-                for (i=0 ; i<namelen ; i++ )
-                {
-                    if(dirname[i]=='\\' || dirname[i]=='/') 
-                    {
-                        char c=dirname[i] ;
-                        dirname[i]=0 ;
-                        mkdir(dirname, 0777);
-                        dirname[i]=c ;
-                    }
+                if(this->completion_channel !=0) {
+                    __atomic_store_n(&this->completion_pending, 1, 
+                                     __ATOMIC_RELEASE) ;
                 }
-            }
-
-            // Create directory if it dosent exist
-            namelen=param_string_alloc_size(context, paramtype,param,0) ; 
-            if(num_params>1) 
-            {
-                char mode[5];
-                char namebuffer[namelen] ;
-                this->f=fopen(param_to_string(context, paramtype, param, 0, 
-                                               namelen, namebuffer),  
-                              param_to_string(context, paramtype, param, 1, 
-                                               sizeof(mode), mode)
-                             );
-            }   
-            else 
-            {
-                char namebuffer[namelen] ;
-                this->f=fopen(param_to_string(context, paramtype, param, 0, 
-                                              namelen, namebuffer), "a");
-            }
-            if(this->f==NULL) 
-            {
-                printf("Could not open file %s\r\n", 
-                        param_to_string(context, paramtype,param,
-                            0, 0, NULL) ) ;
+                timer_group_leave(this) ;
             }
         }
+        group->fired[n++]=this ;
+    }
+    group->deadline+=group->period_ns ;
+    pthread_mutex_unlock(&timer_groups_lock) ;
 
-        break ;
-    case write_rmcios:
-        if(this==NULL) break ;
-        if(this->f==NULL )  break ;
+    for(i=0 ; i<n ; i++) executor_submit(&group->fired[i]->job) ;
+}
 
-        if(num_params<1) 
+// (Re)start timer with expirations every period_ns from now. Joins group 
+// whose next expiration after one period is within the slack of the timer.
+static void timer_arm(struct timer_data *this)
+{
+    struct timer_group *group, *unused=NULL ;
+    uint64_t deadline ;
+    pthread_mutex_lock(&timer_groups_lock) ;
+    timer_group_leave(this) ;
+    if(this->period_ns==0)
+    {
+        pthread_mutex_unlock(&timer_groups_lock) ;
+        return ;
+    }
+    deadline=clock_ns(CLOCK_MONOTONIC)+this->period_ns ;
+    for(group=timer_groups ; group!=NULL ; group=group->next)
+    {
+        int64_t diff ;
+        if(group->len==0) 
         {
-            fflush(this->f) ;
+            if(unused==NULL) unused=group ;
+            continue ;
         }
-        else 
+        if(group->period_ns!=this->period_ns) continue ;
+        // Delay to the next group expiration in range [0, period). 
+        // First expiration is never earlier than one period from now.
+        diff=(int64_t)(group->deadline-deadline) % (int64_t)this->period_ns;
+        if(diff < 0) diff+=this->period_ns ;
+        if(diff <= (int64_t)this->slack_ns)
         {
-            // Determine the needed buffer size
-            plen= param_string_alloc_size(context, paramtype, param, 0) ; 
-            {
-                char buffer[plen] ; // allocate buffer
-                s=param_to_string(context, paramtype,param, 0, 
-                                  plen, buffer) ;
-                fprintf(this->f,"%s",s) ;
-                fflush(this->f) ;
-            }
+            deadline+=diff ;
+            break ;
         }
-
-        break ;
-    case read_rmcios:
-        if(this==NULL)
+    }
+    if(group==NULL && unused!=NULL) group=unused ;
+    if(group==NULL)
+    {
+        group=calloc(1, sizeof(struct timer_group)) ;
+        if(group==NULL) 
         {
-            int namelen;
-            namelen=param_string_alloc_size(context, paramtype,param, 0) ;
-            {
-                char namebuffer[namelen] ;
-                s=param_to_string(context, paramtype,param, 0, 
-                                  namelen, namebuffer) ;
-                FILE *f ;
-                int fsize ;
-
-                f=fopen(s,"rb") ;
-                if(f==NULL) break ;
-                fseek(f, 0, SEEK_END); // seek to end of file
-                fsize = ftell(f); // get current file pointer
-                fseek(f, 0, SEEK_SET); // seek back to beginning of file
-                // Allocate memory for the file:
-                {
-                    char fbuffer[fsize] ;
-                    fread (fbuffer,1,fsize,f);
-                    // Return the contents of the file in one call.
-                    return_buffer(context, paramtype,returnv,fbuffer,fsize) ;
-                }   
-                fclose(f) ;
-            }
+            pthread_mutex_unlock(&timer_groups_lock) ;
+            printf("Failed to setup timer\n");
+            return ;
         }
-
-        break ;
-}
+        group->source.handler=timer_group_handler ;
+        group->source.fd=timerfd_create(CLOCK_MONOTONIC, 
+                                        TFD_NONBLOCK | TFD_CLOEXEC) ;
+        if(group->source.fd<0 || dispatch_add(&group->source)!=0)
+        {
+            pthread_mutex_unlock(&timer_groups_lock) ;
+            if(group->source.fd>=0) close(group->source.fd) ;
+            free(group) ;
+            printf("Failed to setup timer\n");
+            return ;
+        }
+        group->next=timer_groups ;
+        timer_groups=group ;
+    }
+    if(group->len==0)
+    {
+        // Arm new or reused group
+        struct itimerspec its ;
+        its.it_interval.tv_sec=this->period_ns/1000000000ull ;
+        its.it_interval.tv_nsec=this->period_ns%1000000000ull ;
+        its.it_value.tv_sec=deadline/1000000000ull ;
+        its.it_value.tv_nsec=deadline%1000000000ull ;
+        group->period_ns=this->period_ns ;
+        group->deadline=deadline ;
+        timerfd_settime(group->source.fd, TFD_TIMER_ABSTIME, &its, 0) ;
+    }
+    if(group->len==group->size)
+    {
+        int size= group->size>0 ? group->size*2 : 4 ;
+        struct timer_data **members=realloc(group->members, 
+                                        size*sizeof(struct timer_data *)) ;
+        if(members==NULL)
+        {
+            pthread_mutex_unlock(&timer_groups_lock) ;
+            printf("Failed to setup timer\n");
+            return ;
+        }
+        group->members=members ;
+        group->size=size ;
+    }
+    this->deadline=deadline ;
+    this->group=group ;
+    this->group_index=group->len ;
+    group->members[group->len++]=this ;
+    pthread_mutex_unlock(&timer_groups_lock) ;
 }
 
-/////////////////////////////////////////////////////////
-// Clock to get elapsed time            
-/////////////////////////////////////////////////////////
-struct clock_data 
-{
-    uint64_t start ;
-} ;
-
-static uint64_t GetTickCount()
+// Run linked channels of fired timer. Runs in executor.
+static void timer_job_run(struct executor_job *job)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)(ts.tv_nsec / 1000000) + ((uint64_t)ts.tv_sec * 1000ull);
+    struct timer_data *this=(struct timer_data*)
+        ((char *)job - offsetof(struct timer_data, job)) ;
+    profile_run_linked(this->id) ;
+    if(__atomic_exchange_n(&this->completion_pending, 0, __ATOMIC_ACQ_REL))
+    {
+        profile_run(this->completion_channel) ;
+    }
 }
 
-void clock_class_func(struct clock_data *this, 
-                      const struct rmcios_context *context, 
-                      int id, enum type_rmcios function,
-                      int paramtype, union param_rmcios returnv, 
-                      int num_params,union param_rmcios param)
+// Module level timer setup (setup timer option ...)
+static void timer_module_setup(const struct context_rmcios *context,
+                               int paramtype, int num_params,
+                               union param_rmcios param)
 {
- switch(function)
- {   
-     case help_rmcios:
-         return_string(context,paramtype,returnv,
-                       "clock channel help\r\n"
-                       " create clock ch_name\r\n"
-                       " read ch_name \r\n"
-                       "   #reads elapsed time (s)\r\n"
-                       " write ch_name \r\n"
-                       "   #read time, send to linked and reset time\r\n"
-                       " link ch_name linked #link time output on reset\r\n"
-                       ) ;
-         break ;
-
-     case create_rmcios:
-         if(num_params<1) break ;
-         this=  (struct clock_data *) malloc(sizeof( struct clock_data)) ;
-         create_channel_param(context, paramtype,param,0 ,
-                 (class_rmcios)clock_class_func, this) ;
-         //default values :
-         this->start= GetTickCount() ;
-         break ;
+    if(num_params<1) return ;
+    if(param_is_keyword(context, paramtype, param, 0, "workers"))
+    {
+        int workers=0, queue_size=256 ;
+        struct executor_pool *old ;
+        if(executor_current_pool!=NULL)
+        {
+            // Worker would wait for itself to stop
+            printf("Timer workers can not be changed from timer worker\r\n");
+            return ;
+        }
+        if(num_params>1) workers=param_to_int(context, paramtype, param, 1);
+        if(num_params>2) 
+        {
+            queue_size=param_to_int(context, paramtype, param, 2) ;
+        }
+        pthread_rwlock_wrlock(&executor.config_lock) ;
+        old=executor.pool ;
+        executor.pool=executor_start(workers, queue_size) ;
+        pthread_rwlock_unlock(&executor.config_lock) ;
+        // New jobs go to new pool while old workers run their queues
+        executor_stop(old) ;
+    }
+    else if(param_is_keyword(context, paramtype, param, 0, "rt") 
+            || param_is_keyword(context, paramtype, param, 0, "cpus"))
+    {
+        int i ;
+        pthread_mutex_lock(&dispatch_sched.lock) ;
+        if(param_is_keyword(context, paramtype, param, 0, "cpus"))
+        {
+            char list[256] ;
+            list[0]=0 ;
+            if(num_params>1)
+            {
+                param_to_string(context, paramtype, param, 1, 
+                                sizeof(list), list) ;
+            }
+            dispatch_sched.pinned=
+                dispatch_parse_cpus(list, &dispatch_sched.cpus)>0 ;
+        }
+        else if(num_params<2 
+                || param_is_keyword(context, paramtype, param, 1, "other"))
+        {
+            dispatch_sched.policy=SCHED_OTHER ;
+            dispatch_sched.priority=0 ;
+        }
+        else
+        {
+            int policy= param_is_keyword(context, paramtype, param, 1, "rr")
+                        ? SCHED_RR : SCHED_FIFO ;
+            int priority=50 ;
+            if(num_params>2) 
+            {
+                priority=param_to_int(context, paramtype, param, 2) ;
+            }
+            if(priority<sched_get_priority_min(policy)) 
+            {
+                priority=sched_get_priority_min(policy) ;
+            }
+            if(priority>sched_get_priority_max(policy)) 
+            {
+                priority=sched_get_priority_max(policy) ;
+            }
+            dispatch_sched.policy=policy ;
+            dispatch_sched.priority=priority ;
+        }
+        pthread_mutex_unlock(&dispatch_sched.lock) ;
 
-     case read_rmcios:
-         if(this==NULL) break ;
-         uint64_t ticknow ;
-         ticknow=GetTickCount();
-         float elapsed = ((float)(ticknow-this->start))/1000.0  ;
-         return_float( context, paramtype, returnv, elapsed ) ;
-         break ;
-     
-     case write_rmcios:
-         if(this==NULL) break ;
-         else
-         {
-             uint64_t ticknow ;
-             ticknow=GetTickCount();
-             float elapsed = ((float)(ticknow-this->start))/1000.0 ;
-             return_float( context, paramtype, returnv, elapsed ) ;
-                write_f(context, linked_channels(context, id), elapsed) ;    
-             this->start=ticknow ;
-         }
-         break ; 
- }
+        // Apply to running timer threads
+        pthread_once(&dispatch_once, dispatch_start) ;
+        if(dispatch_running) dispatch_thread_configure(dispatch_thread) ;
+        pthread_rwlock_rdlock(&executor.config_lock) ;
+        for(i=0 ; executor.pool!=NULL && i<executor.pool->started ; i++)
+        {
+            dispatch_thread_configure(executor.pool->threads[i]) ;
+        }
+        pthread_rwlock_unlock(&executor.config_lock) ;
+    }
+    else if(param_is_keyword(context, paramtype, param, 0, "mlock"))
+    {
+        dispatch_memory_lock(num_params>1 ? 
+                             param_to_int(context, paramtype, param, 1) : 1);
+    }
 }
 
-/////////////////////////////////////////////////////
-// Timer channel
-/////////////////////////////////////////////////////
-struct timer_data
-{
-    float period ;
-    unsigned int loops ; 
-    timer_t timerID ;
-    struct sigevent         te;
-    struct itimerspec       its; // Timer 
-    struct sigaction        sa;
-    int index ; 
-    int completion_channel ;
-    int id    
-} ;
-
-static void timerHandler( int sig, siginfo_t *si, void *uc )
+// Kernel timers and timer channels using them (read timer groups)
+static void timer_groups_read(const struct context_rmcios *context,
+                              int paramtype, union param_rmcios returnv)
 {
-    struct timer_data *this=(struct timer_data*) si->si_value.sival_ptr; 
-    module_context->run_channel(module_context, 
-                                linked_channels(module_context, this->id),
-                                write_rmcios, int_rmcios,
-                                (union param_rmcios)0,
-                                0,(union param_rmcios)0) ;
-    
-    if(this->loops>0)
+    struct timer_group *group ;
+    int groups=0, members=0 ;
+    char buffer[64] ;
+    pthread_mutex_lock(&timer_groups_lock) ;
+    for(group=timer_groups ; group!=NULL ; group=group->next)
     {
-        this->index++ ;
-        if(this->index >= this->loops ) // Disarm timer
-        {
-            struct itimerspec its; // Timer 
-            if(this->completion_channel !=0) {
-                module_context->run_channel(module_context,
-                                            this->completion_channel,
-                                            write_rmcios, int_rmcios,
-                                            (union param_rmcios)((int)0),0,
-                                            (union param_rmcios)((int)0)
-                                            );
-            }
-            its.it_interval.tv_sec = 0 ;
-            its.it_interval.tv_nsec = 0 ;
-            its.it_value.tv_sec = 0;
-            its.it_value.tv_nsec = 0;
-            timer_settime(this->timerID, 0, &its, 0); // Disarm
-        }
-    }   
+        if(group->len==0) continue ;
+        groups++ ;
+        members+=group->len ;
+    }
+    pthread_mutex_unlock(&timer_groups_lock) ;
+    snprintf(buffer, sizeof(buffer), "groups=%d timers=%d", groups, members);
+    return_string(context, paramtype, returnv, buffer) ;
 }
 
 void timer_class_func(struct timer_data *this, 
-                      const struct rmcios_context *context, 
+                      const struct context_rmcios *context, 
                       int id, 
                       enum function_rmcios function,
                       enum type_rmcios paramtype,
@@ -578,8 +6035,33 @@ void timer_class_func(struct timer_data *this,
                  "     # set/reset timer time and run timer.\r\n"
                  " read newname \r\n"
                  "     # Get remaining time\r\n"
+                 " read newname stats\r\n"
+                 "     # fires, overruns, missed periods and latency (ns)\r\n"
+                 " read newname histogram\r\n"
+                 "     # latency counts in ranges [2^(i-1),2^i) ns\r\n"
                  " link timer link_channel\r\n"
                  "     # link to channel called on match.\r\n"
+                 " setup newname serial 1/0\r\n"
+                 "     # Linked channels runs may not overlap (default 1)\r\n"
+                 " setup newname slack seconds\r\n"
+                 "     # Allow start time to be delayed up to seconds to\r\n"
+                 "     # share kernel timer with timers of same period.\r\n"
+                 "     # Applies on next start. (default 0)\r\n"
+                 " read timer groups\r\n"
+                 "     # Number of kernel timers and timers using them\r\n"
+                 " setup timer workers n | queue_size(256)\r\n"
+                 "     # Run linked channels of timers and rtc_timers in\r\n"
+                 "     # pool of n threads. n=0 runs them in the timer\r\n"
+                 "     # dispatcher thread (default). Not allowed from\r\n"
+                 "     # channels run by the workers.\r\n"
+                 " setup timer rt fifo|rr|other | priority(50)\r\n"
+                 "     # Scheduling policy of timer dispatcher and worker\r\n"
+                 "     # threads. fifo and rr need CAP_SYS_NICE.\r\n"
+                 " setup timer cpus list\r\n"
+                 "     # Pin timer threads to cpus e.g. 0,2-3.\r\n"
+                 "     # Empty list removes pinning.\r\n"
+                 " setup timer mlock 1/0\r\n"
+                 "     # Lock process memory and prefault timer stacks\r\n"
                  );
          break;
 
@@ -595,27 +6077,39 @@ void timer_class_func(struct timer_data *this,
          this->loops=0 ;
          this->period=1 ;
          this->completion_channel=0 ;
-         this->id ;
-         int sigNo = SIGRTMIN;
-
-         // Set up signal handler. 
-         this->sa.sa_flags = SA_SIGINFO;
-         this->sa.sa_sigaction = timerHandler;
-         sigemptyset(&this->sa.sa_mask);
-         if (sigaction(sigNo, &this->sa, 0) == -2)
-         {
-             printf("Failed to setup signal handling for timer\n");
-         }
-
-         // Set and enable alarm 
-         this->te.sigev_notify = SIGEV_SIGNAL;
-         this->te.sigev_signo = sigNo;
-         this->te.sigev_value.sival_ptr = this;
-         timer_create(CLOCK_REALTIME, &this->te, &this->timerID);
-
+         this->period_ns=0 ;
+         this->slack_ns=0 ;
+         this->deadline=0 ;
+         this->group=NULL ;
+         memset(&this->stats, 0, sizeof(this->stats)) ;
+         this->job.run=timer_job_run ;
+         this->job.serial=1 ;
+         this->job.pending=0 ;
+         this->completion_pending=0 ;
          break ;
 
      case setup_rmcios:
+         if(this==0) 
+         {
+             timer_module_setup(context, paramtype, num_params, param) ;
+             break ;
+         }
+         if(num_params>0 
+            && param_is_keyword(context, paramtype, param, 0, "serial"))
+         {
+             this->job.serial= num_params>1 ? 
+                               param_to_int(context, paramtype, param, 1) : 1;
+             break ;
+         }
+         if(num_params>0 
+            && param_is_keyword(context, paramtype, param, 0, "slack"))
+         {
+             double slack= num_params>1 ? 
+                           param_to_double(context, paramtype, param, 1) : 0;
+             this->slack_ns= slack>0 ? llround(slack*1E9) : 0 ;
+             break ;
+         }
+         // Fall through - setup with period is the same as write
      case write_rmcios: 
          if(this==0) break ;
          else
@@ -636,68 +6130,232 @@ void timer_class_func(struct timer_data *this,
              {   
                  double fractpart, intpart;
                  fractpart = modf (this->period , &intpart);
-                 this->its.it_interval.tv_sec = (time_t)intpart ;
-                 this->its.it_interval.tv_nsec = (long)(fractpart *1000000);
-                 this->its.it_value.tv_sec = (time_t)intpart ;
-                 this->its.it_value.tv_nsec = (long) (fractpart * 1000000);
-                 timer_settime(this->timerID, 0, &this->its, 0);
+                 this->period_ns = (uint64_t)intpart*1000000000ull
+                                   + (long)(fractpart *1E9) ;
+                 timer_arm(this) ;
              }
          }
          break;
+
+     case read_rmcios:
+         if(this==0) 
+         {
+             if(num_params>0 
+                && param_is_keyword(context, paramtype, param, 0, "groups"))
+             {
+                 timer_groups_read(context, paramtype, returnv) ;
+             }
+             break ;
+         }
+         timer_stats_read(&this->stats, context, paramtype, returnv, 
+                          num_params, param) ;
+         break ;
  }
 }
 
 ///////////////////////////////////////////////////////
 // Realtime clock timer
 ///////////////////////////////////////////////////////
+enum rtc_catchup_policy
+{
+    catchup_skip, // Do not trigger for deadlines older than one period
+    catchup_once, // Trigger once for all missed deadlines
+    catchup_all   // Trigger once for each missed deadline
+} ;
+
 struct rtc_timer_data {
     int id;
-    int offset;
-    int period;
-    time_t prevtime;
-    // linked list of sheduled times:
-    struct rtc_timer_data *nextimer; 
+    int64_t offset; // ns
+    int64_t period; // ns
+    int64_t next; // Next trigger time (ns, timezone shifted realtime)
+    enum rtc_catchup_policy catchup;
+    int catchup_max; // Most runs for missed deadlines with catchup_all
+    int heap_index; // Position in schedule, -1 when not scheduled
+    struct timer_stats stats;
+    struct executor_job job; // Runs linked channels
 } ;
 
-struct rtc_timer_data *first_timer=0 ;
+// Schedule of active rtc timers. Min-heap ordered by next trigger time.
+static struct rtc_timer_data **rtc_schedule=NULL ;
+static int rtc_schedule_len=0 ;
+static int rtc_schedule_size=0 ;
+static pthread_mutex_t rtc_schedule_lock=PTHREAD_MUTEX_INITIALIZER ;
+static struct dispatch_source rtc_ticker_source={-1, NULL} ;
+static pthread_once_t rtc_ticker_once=PTHREAD_ONCE_INIT ;
+
+// Timezone shifted realtime now (ns)
+static int64_t rtc_timer_now(void)
+{
+    struct timespec ts ;
+    clock_gettime(CLOCK_REALTIME, &ts) ;
+    return ((int64_t)ts.tv_sec + timezone_offset) * 1000000000LL 
+           + ts.tv_nsec ;
+}
+
+// Next trigger time of timer after time now. 
+// Trigger times are multiples of period from offset, so errors do not 
+// accumulate.
+static int64_t rtc_timer_next(struct rtc_timer_data *t, int64_t now)
+{
+    int64_t offset = ((t->offset % t->period) + t->period) % t->period ;
+    int64_t next = now - (now % t->period) + offset ;
+    if (next <= now) next += t->period ;
+    return next ;
+}
+
+static void rtc_schedule_swap(int a, int b)
+{
+    struct rtc_timer_data *t = rtc_schedule[a] ;
+    rtc_schedule[a] = rtc_schedule[b] ;
+    rtc_schedule[b] = t ;
+    rtc_schedule[a]->heap_index = a ;
+    rtc_schedule[b]->heap_index = b ;
+}
+
+// Restore heap order after the trigger time of timer at index changed.
+static void rtc_schedule_fix(int index)
+{
+    while (index > 0 
+           && rtc_schedule[index]->next < rtc_schedule[(index-1)/2]->next)
+    {
+        rtc_schedule_swap(index, (index-1)/2) ;
+        index = (index-1)/2 ;
+    }
+    for (;;)
+    {
+        int child = 2*index+1 ;
+        if (child >= rtc_schedule_len) break ;
+        if (child+1 < rtc_schedule_len 
+            && rtc_schedule[child+1]->next < rtc_schedule[child]->next) 
+        {
+            child++ ;
+        }
+        if (rtc_schedule[index]->next <= rtc_schedule[child]->next) break ;
+        rtc_schedule_swap(index, child) ;
+        index = child ;
+    }
+}
+
+static int rtc_schedule_insert(struct rtc_timer_data *t)
+{
+    if (rtc_schedule_len == rtc_schedule_size)
+    {
+        int size = rtc_schedule_size ? rtc_schedule_size*2 : 16 ;
+        struct rtc_timer_data **schedule ;
+        schedule = realloc(rtc_schedule, size*sizeof(*schedule)) ;
+        if (schedule == NULL) return -1 ;
+        rtc_schedule = schedule ;
+        rtc_schedule_size = size ;
+    }
+    t->heap_index = rtc_schedule_len++ ;
+    rtc_schedule[t->heap_index] = t ;
+    rtc_schedule_fix(t->heap_index) ;
+    return 0 ;
+}
+
+static void rtc_schedule_delete(struct rtc_timer_data *t)
+{
+    int index = t->heap_index ;
+    if (index < 0) return ;
+    rtc_schedule_len-- ;
+    if (index != rtc_schedule_len)
+    {
+        rtc_schedule_swap(index, rtc_schedule_len) ;
+        rtc_schedule_fix(index) ;
+    }
+    t->heap_index = -1 ;
+}
+
+// Arm ticker to the earliest trigger time. Disarm when nothing scheduled.
+// Call with rtc_schedule_lock held.
+static void rtc_ticker_arm(void)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}} ;
+    if (rtc_schedule_len > 0)
+    {
+        int64_t deadline = rtc_schedule[0]->next 
+                           - (int64_t)timezone_offset * 1000000000LL ;
+        its.it_value.tv_sec = deadline / 1000000000LL ;
+        its.it_value.tv_nsec = deadline % 1000000000LL ;
+    }
+    timerfd_settime(rtc_ticker_source.fd, 
+                    TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, 0) ;
+}
 
 // Ticker that will handle all rtc scheduled tasks
-static void *rtc_ticker(void *data)
+static void rtc_ticker(struct dispatch_source *source)
 {
-   time_t seconds;
-   //printf("RTC\n") ;
-   // time now
-   seconds = time (NULL);
-   seconds += timezone_offset;
-   struct rtc_timer_data *t = first_timer;
+   uint64_t expirations ;
+   int64_t now;
+   int i ;
 
-   while (t != NULL)
+   // Reading a cancelled timer fails when system time has been changed
+   if (read(source->fd, &expirations, sizeof(expirations)) < 0 
+       && errno == ECANCELED)
    {
-      // timer is active
-      if (t->period != 0)       
+      // Time has changed -> reschedule all to next possible:
+      pthread_mutex_lock(&rtc_schedule_lock) ;
+      now = rtc_timer_now() ;
+      for (i = 0 ; i < rtc_schedule_len ; i++)
       {
-         // Time has changed -> change prevtime to lastest possible:
-         if (t->prevtime > seconds || (seconds - t->prevtime) >= t->period * 2)
-         {
-            t->prevtime = seconds + (t->offset % t->period) 
-                          - (seconds % t->period);
-         }
-         // Trigger
-         if (seconds >= (t->prevtime + t->period))
-         {      
-            // Execute linked channels
-            write_fv (module_context, 
-                      linked_channels(module_context, t->id), 
-                      0, 0);   
-
-            // Update calculated current trigger time :
-            t->prevtime = seconds + (t->offset % t->period) 
-                          - (seconds % t->period);
-         }
+         rtc_schedule[i]->next = rtc_timer_next(rtc_schedule[i], now) ;
+      }
+      for (i = rtc_schedule_len/2 ; i >= 0 ; i--) rtc_schedule_fix(i) ;
+      rtc_ticker_arm() ;
+      pthread_mutex_unlock(&rtc_schedule_lock) ;
+      return ;
+   }
+
+   for (;;)
+   {
+      int64_t missed, runs ;
+      pthread_mutex_lock(&rtc_schedule_lock) ;
+      // time now
+      now = rtc_timer_now() ;
+      if (rtc_schedule_len == 0 || rtc_schedule[0]->next > now) break ;
+
+      // Update calculated next trigger time :
+      struct rtc_timer_data *t = rtc_schedule[0] ;
+      missed = (now - t->next) / t->period ;
+      timer_stats_record(&t->stats, now - t->next - missed * t->period,
+                         missed) ;
+      switch (t->catchup)
+      {
+         case catchup_skip: runs = missed > 0 ? 0 : 1 ; break ;
+         case catchup_all: 
+            runs = missed < t->catchup_max ? missed + 1 : t->catchup_max ;
+            break ;
+         default: runs = 1 ; break ;
       }
-      t = t->nextimer;
+      t->next = rtc_timer_next(t, now) ;
+      rtc_schedule_fix(0) ;
+      pthread_mutex_unlock(&rtc_schedule_lock) ;
+
+      // Execute linked channels
+      while (runs-- > 0) executor_submit(&t->job) ;
    }
-   return ;
+   rtc_ticker_arm() ;
+   pthread_mutex_unlock(&rtc_schedule_lock) ;
+}
+
+// Run linked channels of triggered rtc timer. Runs in executor.
+static void rtc_timer_job_run(struct executor_job *job)
+{
+   struct rtc_timer_data *t = (struct rtc_timer_data *)
+       ((char *)job - offsetof(struct rtc_timer_data, job)) ;
+   profile_run_linked(t->id) ;
+}
+
+// Create the ticker on first use. No ticker runs without rtc timers.
+static void setup_rtc_timer_ticker(void)
+{   
+    rtc_ticker_source.handler = rtc_ticker ;
+    rtc_ticker_source.fd = timerfd_create(CLOCK_REALTIME, 
+                                          TFD_NONBLOCK | TFD_CLOEXEC) ;
+    if (rtc_ticker_source.fd < 0 || dispatch_add(&rtc_ticker_source) != 0)
+    {
+        printf("Failed to setup rtc timer ticker\n");
+    }
 }
 
 void rtc_timer_class_func(struct rtc_timer_data *t, 
@@ -718,7 +6376,20 @@ void rtc_timer_class_func(struct rtc_timer_data *t,
                  "               | min(0) | h(0) "
                  "               | day(0=Thursday)) "
                  "               | month(1) | year(1970) \r\n"
-                 " read newname\r\n"
+                 "  -period and offset may have decimals. Text and\r\n"
+                 "   integer values are exact to the nanosecond, float\r\n"
+                 "   values have float precision (0.1 -> 100000001 ns)\r\n"
+                 " setup newname catchup skip|once|all | max_runs(100)\r\n"
+                 "   #Triggering after missed periods: skip when late by\r\n"
+                 "   #a period or more, once (default) or once for each\r\n"
+                 "   #missed period, at most max_runs times\r\n"
+                 " setup newname serial 1/0\r\n"
+                 "   #Linked channels runs may not overlap (default 1)\r\n"
+                 " read newname #time to next trigger (s)\r\n"
+                 " read newname stats\r\n"
+                 "   #fires, overruns, missed periods and latency (ns)\r\n"
+                 " read newname histogram\r\n"
+                 "   #latency counts in ranges [2^(i-1),2^i) ns\r\n"
                  " link newname execute_channel\r\n"
                  );
          break ;
@@ -731,36 +6402,67 @@ void rtc_timer_class_func(struct rtc_timer_data *t,
          // Default values:
          t->offset = 0;
          t->period = 0;
-         t->prevtime = 0;
-         t->nextimer = 0; 
+         t->next = 0;
+         t->catchup = catchup_once;
+         t->catchup_max = 100;
+         t->heap_index = -1; 
+         memset(&t->stats, 0, sizeof(t->stats));
+         t->job.run = rtc_timer_job_run;
+         t->job.serial = 1;
+         t->job.pending = 0;
          t->id = create_channel_param(context, paramtype,param, 0, 
                                       (class_rmcios)rtc_timer_class_func, t); 
-
-         // Attach timer to executing timers:
-         if(first_timer == 0) first_timer = t;
-         else {
-             struct rtc_timer_data *p_iter = first_timer;
-             while(p_iter->nextimer != 0) {
-                 p_iter=p_iter->nextimer;
-             }
-             // Add to be executed.
-             p_iter->nextimer=t ; 
-         }
          break ;
 
      case setup_rmcios:
          if(t == 0) break;
+         if(num_params > 0 
+            && param_is_keyword(context, paramtype, param, 0, "serial"))
+         {
+             t->job.serial = num_params > 1 ? 
+                             param_to_int(context, paramtype, param, 1) : 1;
+             break;
+         }
+         if(num_params > 0 
+            && param_is_keyword(context, paramtype, param, 0, "catchup"))
+         {
+             t->catchup = catchup_once;
+             if(num_params < 2) break;
+             if(param_is_keyword(context, paramtype, param, 1, "skip"))
+             {
+                 t->catchup = catchup_skip;
+             }
+             else if(param_is_keyword(context, paramtype, param, 1, "all"))
+             {
+                 t->catchup = catchup_all;
+                 t->catchup_max = num_params > 2 ? 
+                                  param_to_int(context, paramtype, param, 2)
+                                  : 100;
+                 if(t->catchup_max < 1) t->catchup_max = 1;
+             }
+             break;
+         }
          {
-             time_t seconds;
+             int64_t now;
              // time now
-             seconds=time(0); 
+             now=rtc_timer_now(); 
 
              // only perioid as parameter
              if(num_params<1) break; 
              {
 
-                 time_t sync_time = 0;
-                 t->period = param_to_int(context, paramtype, param, 0);
+                 int64_t sync_time = 0;
+                 t->period = param_to_ns(context, paramtype, param, 0);
+                 if(t->period <= 0)
+                 {
+                     // Stop the timer
+                     t->period = 0 ;
+                     pthread_mutex_lock(&rtc_schedule_lock) ;
+                     rtc_schedule_delete(t) ;
+                     rtc_ticker_arm() ;
+                     pthread_mutex_unlock(&rtc_schedule_lock) ;
+                     break ;
+                 }
                  t->offset = sync_time % t->period;
              }
              struct tm newtime;
@@ -775,8 +6477,12 @@ void rtc_timer_class_func(struct rtc_timer_data *t,
              newtime.tm_sec=0;
              newtime.tm_isdst=0;
 
+             int64_t second_ns = 0, second_whole = 0;
              if(num_params>=2){ 
-                 newtime.tm_sec=param_to_int(context, paramtype, param, 1);
+                 second_ns=param_to_ns(context, paramtype, param, 1);
+                 second_whole=second_ns/1000000000LL;
+                 if(second_ns%1000000000LL<0) second_whole--;
+                 newtime.tm_sec=second_whole;
              }
              if(num_params>=3){
                  newtime.tm_min=param_to_int(context, paramtype, param, 2);
@@ -796,65 +6502,43 @@ void rtc_timer_class_func(struct rtc_timer_data *t,
                  // years since 1900
                  newtime.tm_year=param_to_int(context, paramtype,param, 6)-1900;
              }
-             time_t sync_time ;
-             sync_time = mktime(&newtime) ;
+             int64_t sync_time ;
+             sync_time = mktime(&newtime) * 1000000000LL 
+                         + second_ns - second_whole * 1000000000LL ;
              t->offset = sync_time % t->period ;
-             t->prevtime = seconds + (t->offset % t->period) 
-                          - (seconds % t->period) ;
+
+             // Attach timer to executing timers:
+             pthread_once(&rtc_ticker_once, setup_rtc_timer_ticker) ;
+             pthread_mutex_lock(&rtc_schedule_lock) ;
+             rtc_schedule_delete(t) ;
+             t->next = rtc_timer_next(t, now) ;
+             rtc_schedule_insert(t) ;
+             rtc_ticker_arm() ;
+             pthread_mutex_unlock(&rtc_schedule_lock) ;
          }
          break ;
      case read_rmcios:
          if(t == 0) break;
+         if(timer_stats_read(&t->stats, context, paramtype, returnv,
+                             num_params, param)) break;
          {
-             time_t seconds;
-             // time now
-             seconds = time(0); 
-             seconds += timezone_offset;  
-             int tleft = t->prevtime + t->period-seconds;
-             return_int(context, paramtype, returnv, tleft);
+             float tleft = (t->next - rtc_timer_now()) / 1E9;
+             return_float(context, paramtype, returnv, tleft);
          }
          break ;
  }
 }
 
-static timer_t timerID ;
-
-void setup_rtc_timer_ticker()
-{   
-    struct sigevent te;
-    // Timer 
-    struct itimerspec its; 
-    struct sigaction sa;
-
-    int sigNo = SIGRTMIN;
-
-    // Set up signal handler. 
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = rtc_ticker;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(sigNo, &sa, 0) == -3)
-    {
-        printf("Failed to setup signal handling for timer\n");
-    }
-
-    // Set and enable alarm 
-    te.sigev_notify = SIGEV_SIGNAL;
-    te.sigev_signo = sigNo;
-    te.sigev_value.sival_ptr = &timerID ;
-    timer_create(CLOCK_REALTIME, &te, &timerID);
-
-    // Looping timer every 100ms 
-    its.it_interval.tv_sec = 0 ;
-    its.it_interval.tv_nsec =  ((long)100000) ;
-    its.it_value.tv_sec = 0 ;
-    its.it_value.tv_nsec = ((long)100000);
-    timer_settime(timerID, 0, &its, 0);
-    return ;
-}
-
 void init_gnu_channels(const struct context_rmcios *context)
 { 
     module_context=context;
+    profile_context=*context ;
+    profile_context.run_channel=profile_run_channel ;
+    time_format_compile(&default_rtc_str_data.compiled, 
+                        default_rtc_str_data.rtc_str_format, 
+                        default_rtc_str_data.second_decimals) ;
+    file_data_init(&fconout) ;
+    input_data_init(&conin) ;
     fconout.f = stdout ; 
     create_channel_str(context, "rtc", (class_rmcios)rtc_class_func, 0);
     create_channel_str(context, "rtc_str", (class_rmcios)rtc_str_class_func,
@@ -862,12 +6546,20 @@ void init_gnu_channels(const struct context_rmcios *context)
     create_channel_str(context, "file", (class_rmcios)file_class_func, 0); 
     create_channel_str(context, "console", (class_rmcios)file_class_func, 
                        &fconout ) ;
+    create_channel_str(context, "input", (class_rmcios)input_class_func, 0);
+    conin.id=create_channel_str(context, "console_in", 
+                                (class_rmcios)input_class_func, &conin) ;
+    create_channel_str(context, "shm", (class_rmcios)shm_class_func, 0);
     create_channel_str(context, "clock", (class_rmcios)clock_class_func, 0);
+    create_channel_str(context, "binlog", (class_rmcios)binlog_class_func, 0);
+    create_channel_str(context, "ringfile", 
+                       (class_rmcios)ringfile_class_func, 0) ;
+    create_channel_str(context, "follow", (class_rmcios)follow_class_func, 0);
     create_channel_str(context, "timer", (class_rmcios)timer_class_func, 0); 
     create_channel_str(context, "rtc_timer",
                        (class_rmcios)rtc_timer_class_func, 0) ; 
-    
-    setup_rtc_timer_ticker() ;
+    create_channel_str(context, "profiler",
+                       (class_rmcios)profiler_class_func, 0) ; 
     return  ;
 }
 
@@ -0,0 +1,217 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Shared memory latest value segment of shm channels.
+
+   Segment is a POSIX shared memory object (/dev/shm/name) that starts
+   with struct rmcios_shm_header followed by num_slots slots. Each slot
+   holds the latest value written to one shm channel and is protected by
+   a sequence counter (seqlock): writer makes seq odd, changes the slot
+   and makes seq even again. Readers never block the writer or each
+   other, and read without system calls after attaching.
+
+   Segment is owned by the process that created it (owner_pid). When the
+   owner stops, or is restarted and creates the segment again with a new
+   generation, the mapping of a reader is stale: rmcios_shm_stale() 
+   detects this, and the reader attaches again. The check uses system 
+   calls, so readers call it occasionally, e.g. when values get old.
+
+   Reader example:
+     const struct rmcios_shm_header *h=rmcios_shm_attach("values") ;
+     ...
+     if(h==NULL || rmcios_shm_stale(h, "values"))
+     {
+         rmcios_shm_detach(h) ;
+         h=rmcios_shm_attach("values") ;
+     }
+     const struct rmcios_shm_slot *s=rmcios_shm_find(h, "temperature") ;
+     struct rmcios_shm_value v ;
+     if(s!=NULL && rmcios_shm_read(s, &v, 100)==0
+        && v.type==RMCIOS_SHM_FLOAT) printf("%g\n", v.f[0]) ;
+     rmcios_shm_detach(h) ;
+*/
+
+#ifndef RMCIOS_SHM_H
+#define RMCIOS_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RMCIOS_SHM_MAGIC "RMCIOSSM"
+#define RMCIOS_SHM_VERSION 2
+#define RMCIOS_SHM_NAME_SIZE 48
+#define RMCIOS_SHM_VALUE_SIZE 64
+
+enum rmcios_shm_type
+{
+    RMCIOS_SHM_EMPTY=0, // Nothing written yet
+    RMCIOS_SHM_INT=1, // length int64 values
+    RMCIOS_SHM_FLOAT=2, // length double values
+    RMCIOS_SHM_STRING=3 // length bytes, not NUL terminated
+} ;
+
+struct rmcios_shm_header
+{
+    char magic[8] ;
+    uint32_t version ;
+    uint32_t slot_size ; // sizeof(struct rmcios_shm_slot)
+    uint32_t num_slots ;
+    uint32_t used_slots ; // Slots with name. Grows, store release.
+    uint64_t size ; // Size of segment in bytes
+    uint64_t generation ; // Differs each time the segment is created
+    int32_t owner_pid ; // Writing process, 0 after it has detached
+    uint32_t reserved ;
+} ;
+
+// Value of slot
+struct rmcios_shm_value
+{
+    uint32_t type ; // enum rmcios_shm_type
+    uint32_t length ; // Values or bytes
+    int64_t timestamp_ns ; // CLOCK_REALTIME of write
+    union
+    {
+        int64_t i[RMCIOS_SHM_VALUE_SIZE/sizeof(int64_t)] ;
+        double f[RMCIOS_SHM_VALUE_SIZE/sizeof(double)] ;
+        char s[RMCIOS_SHM_VALUE_SIZE] ;
+    } ;
+} ;
+
+struct rmcios_shm_slot
+{
+    uint32_t seq ; // Odd while value is being written
+    uint32_t reserved ;
+    char name[RMCIOS_SHM_NAME_SIZE] ; // NUL terminated, set once
+    struct rmcios_shm_value value ;
+} ;
+
+static inline struct rmcios_shm_slot *rmcios_shm_slots(
+                                         const struct rmcios_shm_header *h)
+{
+    return (struct rmcios_shm_slot *)((char *)h+sizeof(*h)) ;
+}
+
+// Map segment read only. Returns NULL if it does not exist or has
+// different layout.
+static inline const struct rmcios_shm_header *rmcios_shm_attach(
+                                                         const char *name)
+{
+    char path[256] ;
+    struct stat st ;
+    struct rmcios_shm_header *h ;
+    int fd ;
+    path[0]='/' ;
+    strncpy(path+1, name, sizeof(path)-2) ;
+    path[sizeof(path)-1]=0 ;
+    fd=shm_open(path, O_RDONLY, 0) ;
+    if(fd<0) return NULL ;
+    if(fstat(fd, &st)!=0 || (size_t)st.st_size<sizeof(*h))
+    {
+        close(fd) ;
+        return NULL ;
+    }
+    h=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) ;
+    close(fd) ;
+    if(h==MAP_FAILED) return NULL ;
+    if(memcmp(h->magic, RMCIOS_SHM_MAGIC, sizeof(h->magic))!=0
+       || h->version!=RMCIOS_SHM_VERSION
+       || h->slot_size!=sizeof(struct rmcios_shm_slot)
+       || h->size!=(uint64_t)st.st_size)
+    {
+        munmap(h, st.st_size) ;
+        return NULL ;
+    }
+    return h ;
+}
+
+static inline void rmcios_shm_detach(const struct rmcios_shm_header *h)
+{
+    if(h!=NULL) munmap((void *)h, h->size) ;
+}
+
+// Returns 1 when process owner_pid of segment is running.
+static inline int rmcios_shm_owner_alive(const struct rmcios_shm_header *h)
+{
+    pid_t pid=__atomic_load_n(&h->owner_pid, __ATOMIC_ACQUIRE) ;
+    return pid>0 && (kill(pid, 0)==0 || errno==EPERM) ;
+}
+
+// Returns 1 when mapped segment h is no longer the segment of name: 
+// owner has stopped, or the segment has been created again.
+static inline int rmcios_shm_stale(const struct rmcios_shm_header *h,
+                                   const char *name)
+{
+    const struct rmcios_shm_header *current=rmcios_shm_attach(name) ;
+    int stale= current==NULL || current->generation!=h->generation 
+               || !rmcios_shm_owner_alive(h) ;
+    rmcios_shm_detach(current) ;
+    return stale ;
+}
+
+// Find slot by channel name. Returns NULL when not found.
+static inline const struct rmcios_shm_slot *rmcios_shm_find(
+                                       const struct rmcios_shm_header *h,
+                                       const char *name)
+{
+    uint32_t i, used ;
+    if(h==NULL) return NULL ;
+    used=__atomic_load_n(&h->used_slots, __ATOMIC_ACQUIRE) ;
+    for(i=0 ; i<used && i<h->num_slots ; i++)
+    {
+        const struct rmcios_shm_slot *slot=rmcios_shm_slots(h)+i ;
+        if(strncmp(slot->name, name, RMCIOS_SHM_NAME_SIZE)==0) return slot ;
+    }
+    return NULL ;
+}
+
+// Copy consistent value of slot. Retries at most tries times while the
+// writer is changing the value. Returns 0 on success, -1 when busy.
+static inline int rmcios_shm_read(const struct rmcios_shm_slot *slot,
+                                  struct rmcios_shm_value *value, int tries)
+{
+    while(tries-->0)
+    {
+        uint32_t seq=__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) ;
+        if(seq & 1) continue ;
+        memcpy(value, (const void *)&slot->value, sizeof(*value)) ;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE) ;
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED)==seq) return 0 ;
+    }
+    return -1 ;
+}
+
+// Writer side. Only one thread may write a slot at a time.
+static inline void rmcios_shm_write(struct rmcios_shm_slot *slot,
+                                    const struct rmcios_shm_value *value)
+{
+    uint32_t seq=slot->seq ;
+    __atomic_store_n(&slot->seq, seq+1, __ATOMIC_RELAXED) ;
+    __atomic_thread_fence(__ATOMIC_RELEASE) ;
+    memcpy(&slot->value, value, sizeof(*value)) ;
+    __atomic_store_n(&slot->seq, seq+2, __ATOMIC_RELEASE) ;
+}
+
+#endif